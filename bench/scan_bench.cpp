@@ -0,0 +1,184 @@
+#include "../src/http/message.h"
+#include "../src/http/scan.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_X86 1
+#endif
+
+/**
+ * Time the parsing of a browser-like request head, with a long `Cookie'
+ * and `User-Agent', and the header name kernels over its names. Reports
+ * bytes of head per cycle, or per nanosecond without a TSC.
+ *
+ * Usage: scan_bench [cookie-bytes] [iterations]
+ *
+ * The project builds with `CMAKE_BUILD_TYPE' Debug; compare the kernels in
+ * an optimized build, e.g. with `-DCMAKE_CXX_FLAGS=-O2'.
+ */
+
+/**
+ *@brief Read the cycle counter, or the steady clock in nanoseconds
+ */
+static std::uint64_t now()
+{
+#ifdef BENCH_X86
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+/**
+ *@brief Build a request head as a browser sends it
+ *
+ * @param cookie_size the length of the `Cookie' value
+ */
+static std::string requestHead(std::size_t cookie_size)
+{
+    std::string cookie;
+
+    for (int i = 0; cookie.size() < cookie_size; i++)
+        cookie.append("session_" + std::to_string(i) +
+                      "=a3f9c2e17b4d4e0f9a8b6c5d4e3f2a1b; ");
+    cookie.resize(cookie_size);
+
+    return "GET /files/index.html?lang=en HTTP/1.1\r\n"
+           "Host: www.example.com\r\n"
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+           "(KHTML, like Gecko) Chrome/126.0.0.0 Safari/537.36 "
+           "Edg/126.0.2592.87\r\n"
+           "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+           "image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+           "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+           "Accept-Language: en-US,en;q=0.9,fr;q=0.8\r\n"
+           "Cache-Control: max-age=0\r\n"
+           "Cookie: " +
+           cookie +
+           "\r\n"
+           "Referer: https://www.example.com/search?q=http+server\r\n"
+           "Sec-Ch-Ua: \"Chromium\";v=\"126\", \"Not.A/Brand\";v=\"24\"\r\n"
+           "Sec-Ch-Ua-Mobile: ?0\r\n"
+           "Sec-Ch-Ua-Platform: \"Linux\"\r\n"
+           "Sec-Fetch-Dest: document\r\n"
+           "Sec-Fetch-Mode: navigate\r\n"
+           "Sec-Fetch-Site: same-origin\r\n"
+           "Upgrade-Insecure-Requests: 1\r\n"
+           "Connection: keep-alive\r\n"
+           "\r\n";
+}
+
+int main(int argc, char ** argv)
+{
+    std::size_t cookie_size =
+        argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2048;
+    std::size_t iterations =
+        argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000;
+
+    if (iterations == 0)
+    {
+        std::cerr << "Usage: scan_bench [cookie-bytes] [iterations]\n";
+        return 1;
+    }
+
+    const std::string head  = requestHead(cookie_size);
+    const double      bytes = static_cast<double>(head.size()) * iterations;
+
+    const char * unit = "cycle";
+#ifndef BENCH_X86
+    unit = "ns";
+#endif
+
+    std::cout << "Head of " << head.size() << " bytes, header names checked "
+              << "with " << scan::KernelName() << '\n';
+
+    // Keeps the calls from being optimized out
+    volatile std::size_t sink = 0;
+
+    // The whole parse, as the server does it for every request
+    message::Message message;
+    std::uint64_t    start = now();
+    for (std::size_t i = 0; i < iterations; i++)
+    {
+        message.SetRequest(head);
+        sink = sink + message.GetRequestPointer()->GetHeaderLines().size();
+    }
+    std::uint64_t parse_time = now() - start;
+
+    std::cout << "Request parse: " << bytes / parse_time << " bytes/" << unit
+              << '\n';
+
+    // The line and colon search the parse does, by itself
+    start = now();
+    for (std::size_t i = 0; i < iterations; i++)
+    {
+        std::string_view rest = head;
+
+        for (std::size_t end; (end = scan::FindByte(rest, '\n')) !=
+                              std::string_view::npos;
+             rest.remove_prefix(end + 1))
+            sink = sink + scan::FindByte(rest.substr(0, end), ':');
+    }
+    std::uint64_t find_time = now() - start;
+
+    std::cout << "FindByte over the lines: " << bytes / find_time << " bytes/"
+              << unit << '\n';
+
+    // The names of the head, checked by each kernel the CPU runs
+    std::vector<std::string_view> names;
+    std::size_t                   name_bytes = 0;
+    std::string_view              rest       = head;
+
+    for (std::size_t end;
+         (end = scan::FindByte(rest, '\n')) != std::string_view::npos;
+         rest.remove_prefix(end + 1))
+        if (std::size_t colon = scan::FindByte(rest.substr(0, end), ':');
+            colon != std::string_view::npos)
+        {
+            names.push_back(rest.substr(0, colon));
+            name_bytes += colon;
+        }
+
+    struct
+    {
+        scan::Kernel kernel;
+        const char * name;
+    } kernels[] = {
+        {scan::Kernel::SCALAR, "scalar"},
+        {scan::Kernel::SSSE3, "ssse3"},
+        {scan::Kernel::AVX2, "avx2"},
+    };
+
+    for (const auto & [kind, name] : kernels)
+    {
+        // Resolved once, outside the timed loop
+        scan::HeaderNameKernel kernel = scan::HeaderNameKernelOf(kind);
+
+        if (!kernel)
+        {
+            std::cout << name << ": not supported by this CPU\n";
+            continue;
+        }
+
+        start = now();
+        for (std::size_t i = 0; i < iterations; i++)
+            for (std::string_view header_name : names)
+                sink = sink + kernel(header_name.data(), header_name.size());
+        std::uint64_t name_time = now() - start;
+
+        std::cout << name << ": header names "
+                  << static_cast<double>(name_bytes) * iterations / name_time
+                  << " bytes/" << unit << '\n';
+    }
+
+    return 0;
+}
@@ -1,38 +1,99 @@
 #include "message.h"
+#include "scan.h"
 #include <algorithm>
 #include <cctype>
-#include <filesystem>
-#include <fstream>
-#include <sstream>
-
-namespace fs = std::filesystem;
+#include <charconv>
+#include <cstdlib>
+#include <unistd.h>
 
 const std::unordered_map<int, std::string>
     message::Message::Response::HTTP_STATUS_CODE = {
         {200, "OK"},
         {404, "Not Found"},
         {201, "Created"},
+        {400, "Bad Request"},
+        {406, "Not Acceptable"},
+        {411, "Length Required"},
+        {502, "Bad Gateway"},
 };
 
+std::size_t
+message::CaseInsensitiveHash::operator()(const std::string & s) const
+{
+    std::size_t hash = 14695981039346656037ull; /* FNV-1a */
+
+    for (unsigned char c : s)
+        hash = (hash ^ static_cast<unsigned char>(std::tolower(c))) *
+               1099511628211ull;
+
+    return hash;
+}
+
+bool message::CaseInsensitiveEqual::operator()(const std::string & a,
+                                               const std::string & b) const
+{
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) ==
+                      std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
 std::string
-message::Message::Request::TrimInvisibleCharacters(const std::string & s)
+message::Message::Request::TrimInvisibleCharacters(std::string_view s)
 {
     return std::string(
         std::find_if_not(s.begin(), s.end(), ::isspace),
         std::find_if_not(s.rbegin(), s.rend(), ::isspace).base());
 }
 
-void message::Message::Request::ParsePath()
+/**
+ *@brief Cut the first line out of `rest', dropping the line terminator
+ *
+ * @param rest the unparsed data, advanced past the line
+ * @return std::string_view the line without `\r\n' or `\n'
+ */
+static std::string_view takeLine(std::string_view & rest)
 {
-    std::string copy_path = status_line.path;
+    size_t           line_end = scan::FindByte(rest, '\n');
+    std::string_view line     = rest.substr(0, line_end);
+
+    rest.remove_prefix(line_end == std::string_view::npos ? rest.size()
+                                                          : line_end + 1);
 
-    copy_path.erase(0, copy_path.find_first_not_of('/'));
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+
+    return line;
+}
+
+/**
+ *@brief Cut the next `delimiter' separated field out of `rest'
+ *
+ * @param rest the unparsed data, advanced past the field and the delimiter
+ * @param delimiter the field separator
+ * @return std::string_view the field
+ */
+static std::string_view takeField(std::string_view & rest, char delimiter)
+{
+    size_t           field_end = scan::FindByte(rest, delimiter);
+    std::string_view field     = rest.substr(0, field_end);
+
+    rest.remove_prefix(field_end == std::string_view::npos ? rest.size()
+                                                           : field_end + 1);
+
+    return field;
+}
+
+void message::Message::Request::ParsePath()
+{
+    std::string_view rest = status_line.path;
 
-    std::istringstream iss(copy_path);
-    std::string        single_path;
+    rest.remove_prefix(std::min(rest.find_first_not_of('/'), rest.size()));
 
-    while (std::getline(iss, single_path, '/'))
-        parsed_path.push_back(single_path);
+    // Same splitting as `std::getline': no trailing empty segment
+    while (!rest.empty())
+        parsed_path.emplace_back(takeField(rest, '/'));
 
     parsed_path.push_back("");
 
@@ -41,34 +102,51 @@ void message::Message::Request::ParsePath()
 
 message::Message::Request::Request(const std::string & original_request)
 {
-    std::string        temp;
-    std::istringstream iss(original_request);
+    std::string_view rest = original_request;
 
-    iss >> temp; /* Get the http method */
-    status_line.method = temp;
+    // Ignore empty lines before the request line (RFC 9112 §2.2)
+    while (rest.starts_with("\r\n") || rest.starts_with("\n"))
+        takeLine(rest);
 
-    iss >> temp; /* Get the http path */
-    status_line.path = temp;
+    std::string_view status = takeLine(rest);
 
-    iss >> temp; /* Get the http version */
-    status_line.http_version = std::string(
-        std::find_if(temp.begin(), temp.end(), ::isdigit), temp.end());
+    // Skip the separators between the fields of the status line
+    auto take_status_field = [&status]() {
+        status.remove_prefix(
+            std::min(status.find_first_not_of(' '), status.size()));
+        return takeField(status, ' ');
+    };
+
+    status_line.method = take_status_field(); /* Get the http method */
+    status_line.path   = take_status_field(); /* Get the http path */
 
-    // Ignore empty lines
-    while (std::getline(iss, temp) && temp == "\r");
+    std::string_view version = take_status_field(); /* Get the http version */
+    status_line.http_version = std::string(
+        std::find_if(version.begin(), version.end(), ::isdigit),
+        version.end());
 
-    // Get headers
-    while (std::getline(iss, temp) && temp != "\r")
+    // Get headers, up to the empty line that ends them
+    std::string_view line = rest.empty() ? std::string_view() : takeLine(rest);
+    while (!line.empty())
     {
-        size_t colon_position = temp.find(':'); /* Find colon's position */
-        header_lines[TrimInvisibleCharacters(temp.substr(0, colon_position))] =
-            TrimInvisibleCharacters(
-                temp.substr(colon_position + 1, temp.size()));
+        size_t colon_position = scan::FindByte(line, ':');
+
+        if (colon_position != std::string_view::npos)
+        {
+            std::string key =
+                TrimInvisibleCharacters(line.substr(0, colon_position));
+
+            // Drop lines whose name is not a token instead of storing garbage
+            if (scan::IsValidHeaderName(key))
+                header_lines[std::move(key)] =
+                    TrimInvisibleCharacters(line.substr(colon_position + 1));
+        }
+
+        line = rest.empty() ? std::string_view() : takeLine(rest);
     }
 
     // The remain part is body
-    body = TrimInvisibleCharacters(std::string(
-        std::istreambuf_iterator<char>(iss), std::istreambuf_iterator<char>()));
+    body = TrimInvisibleCharacters(rest);
 
     ParsePath(); /* Parse the request path */
 
@@ -95,23 +173,46 @@ message::Message::Request::GetHeaderLines(const std::string & key) const
     }
 }
 
-const std::string message::Message::Request::GetFullPath() const
-{
-    return fs::current_path().string() + status_line.path;
-}
-
-const std::vector<std::string>
+const std::vector<message::CompressionOption>
 message::Message::Request::GetCompressionOptions()
 {
     if (header_lines.find("Accept-Encoding") == header_lines.end())
-        return std::vector<std::string>();
+        return std::vector<CompressionOption>();
+
+    std::vector<CompressionOption> compression_options;
+    std::string_view               rest = header_lines["Accept-Encoding"];
 
-    std::vector<std::string> compression_options;
-    std::string              option;
-    std::istringstream       iss(header_lines["Accept-Encoding"]);
+    while (!rest.empty())
+    {
+        // `coding;q=0.5', other parameters are ignored
+        std::string_view  element = takeField(rest, ',');
+        CompressionOption option;
+
+        option.coding = TrimInvisibleCharacters(takeField(element, ';'));
+        std::transform(option.coding.begin(), option.coding.end(),
+                       option.coding.begin(), ::tolower);
+
+        while (!element.empty())
+        {
+            std::string parameter =
+                TrimInvisibleCharacters(takeField(element, ';'));
+
+            if (parameter.size() > 2 && (parameter[0] == 'q' ||
+                                         parameter[0] == 'Q') &&
+                parameter[1] == '=')
+            {
+                char * end;
+                double quality = std::strtod(parameter.c_str() + 2, &end);
+
+                // A malformed weight makes the coding unacceptable
+                option.quality = *end == '\0' ? std::clamp(quality, 0.0, 1.0)
+                                               : 0.0;
+            }
+        }
 
-    while (std::getline(iss, option, ','))
-        compression_options.push_back(TrimInvisibleCharacters(option));
+        if (!option.coding.empty())
+            compression_options.push_back(std::move(option));
+    }
 
     return compression_options;
 }
@@ -122,6 +223,59 @@ void message::Message::Response::SetHeaderLine(const std::string & key,
     header_lines[key] = value;
 }
 
+void message::Message::Response::ClearBody()
+{
+    body.clear();
+
+    if (body_file >= 0)
+        close(body_file);
+    body_file      = -1;
+    body_file_size = 0;
+}
+
+void message::Message::Response::SetBodyFile(int fd, std::size_t size)
+{
+    ClearBody();
+
+    body_file      = fd;
+    body_file_size = size;
+}
+
+int message::Message::Response::TakeBodyFile()
+{
+    int fd = body_file;
+
+    body_file      = -1;
+    body_file_size = 0;
+
+    return fd;
+}
+
+void message::Message::Response::LoadBodyFile()
+{
+    if (body_file < 0)
+        return;
+
+    std::string content(body_file_size, '\0');
+    std::size_t loaded = 0;
+
+    while (loaded < content.size())
+    {
+        ssize_t n = pread(body_file, content.data() + loaded,
+                          content.size() - loaded, loaded);
+
+        if (n <= 0)
+            break;
+
+        loaded += n;
+    }
+
+    content.resize(loaded);
+
+    ClearBody();
+    body = std::move(content);
+}
+
 void message::Message::Response::MakeResponse()
 {
     // Set the status line
@@ -129,10 +283,72 @@ void message::Message::Response::MakeResponse()
                std::to_string(status_line.status_code) + " " +
                HTTP_STATUS_CODE.at(status_line.status_code) + "\r\n";
 
-    this->SetHeaderLine("Content-Length", std::to_string(body.size()));
+    this->SetHeaderLine(
+        "Content-Length",
+        std::to_string(HasBodyFile() ? body_file_size : body.size()));
     for (const auto & [key, value] : header_lines)
         response.append(key + ": " + value + "\r\n");
 
     response.append("\r\n");
-    response.append(body);
+
+    // A body file is queued after the head by the server
+    if (!HasBodyFile())
+        response.append(body);
+}
+
+std::size_t message::Message::HeadLength(std::string_view data)
+{
+    std::size_t header_end = data.find("\r\n\r\n");
+
+    return header_end == std::string_view::npos ? 0 : header_end + 4;
+}
+
+std::optional<std::uint64_t>
+message::Message::ContentLength(std::string_view head)
+{
+    std::string_view             rest = head;
+    std::optional<std::uint64_t> content_length;
+
+    takeLine(rest); /* Skip the request line */
+
+    while (!rest.empty())
+    {
+        std::string_view line  = takeLine(rest);
+        std::size_t      colon = scan::FindByte(line, ':');
+
+        if (colon == std::string_view::npos)
+            continue;
+
+        std::string_view name = line.substr(0, colon);
+        name.remove_suffix(name.size() -
+                           std::min(name.find_last_not_of(" \t") + 1,
+                                    name.size()));
+
+        if (!CaseInsensitiveEqual()(std::string(name), "Content-Length"))
+            continue;
+
+        // Whitespace before the colon, a repeated header or a list of
+        // values would let a recipient frame the body differently
+        // (RFC 9112 §6.3)
+        if (name.size() != colon || content_length)
+            return std::nullopt;
+
+        std::string_view value = line.substr(colon + 1);
+        value.remove_prefix(std::min(value.find_first_not_of(" \t"),
+                                     value.size()));
+        value.remove_suffix(value.size() -
+                            std::min(value.find_last_not_of(" \t") + 1,
+                                     value.size()));
+
+        std::uint64_t length;
+        auto [end, error] =
+            std::from_chars(value.data(), value.data() + value.size(), length);
+
+        if (error != std::errc() || end != value.data() + value.size())
+            return std::nullopt;
+
+        content_length = length;
+    }
+
+    return content_length.value_or(0);
 }
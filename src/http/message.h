@@ -1,9 +1,12 @@
 #ifndef _MESSAGE_H_
 #define _MESSAGE_H_
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -14,6 +17,36 @@
 
 BEGIN_MESSAGE_NAMESPACE
 
+/**
+ *@brief Hash header names ignoring ASCII case
+ */
+struct CaseInsensitiveHash
+{
+    std::size_t operator()(const std::string & s) const;
+};
+
+/**
+ *@brief Compare header names ignoring ASCII case
+ */
+struct CaseInsensitiveEqual
+{
+    bool operator()(const std::string & a, const std::string & b) const;
+};
+
+// Header field names are case-insensitive (RFC 9110 §5.1)
+using HeaderLines = std::unordered_map<std::string, std::string,
+                                       CaseInsensitiveHash,
+                                       CaseInsensitiveEqual>;
+
+/**
+ *@brief One element of the `Accept-Encoding' header
+ */
+struct CompressionOption
+{
+    std::string coding;        /* Lowercase content coding, or `*' */
+    double      quality = 1.0; /* The `q' weight */
+};
+
 class Message
 {
 private:
@@ -29,9 +62,9 @@ private:
             StatusLine() {}
         } status_line;
 
-        std::vector<std::string>                     parsed_path;
-        std::unordered_map<std::string, std::string> header_lines;
-        std::string                                  body;
+        std::vector<std::string> parsed_path;
+        HeaderLines              header_lines;
+        std::string              body;
 
         /**
          *@brief Remove invisible characters from the begin and the end of the
@@ -40,7 +73,7 @@ private:
          * @param s the original string
          * @return std::string the string after trim
          */
-        std::string TrimInvisibleCharacters(const std::string & s);
+        std::string TrimInvisibleCharacters(std::string_view s);
 
         /**
          * @brief Parse the request path
@@ -56,11 +89,7 @@ private:
             return parsed_path;
         }
 
-        const std::unordered_map<std::string, std::string> &
-        GetHeaderLines() const
-        {
-            return header_lines;
-        }
+        const HeaderLines & GetHeaderLines() const { return header_lines; }
 
         /**
          *@brief Get the header line by given key
@@ -84,13 +113,6 @@ private:
          */
         const std::string & GetOriginalPath() const { return status_line.path; }
 
-        /**
-         *@brief Get the absolute path of the request path
-         *
-         * @return const std::string the full path of the file
-         */
-        const std::string GetFullPath() const;
-
         /**
          * @brief Get the http method from the status line
          *
@@ -99,11 +121,12 @@ private:
         const std::string & GetHttpMethod() const { return status_line.method; }
 
         /**
-         * @brief Get the types of compression
+         * @brief Get the types of compression with their weights
          *
-         * @return const std::vector<std::string> the types of compressions
+         * @return const std::vector<CompressionOption> the types of
+         * compressions, in the order of the `Accept-Encoding' header
          */
-        const std::vector<std::string> GetCompressionOptions();
+        const std::vector<CompressionOption> GetCompressionOptions();
     };
 
     class Response
@@ -121,8 +144,15 @@ private:
         std::unordered_map<std::string, std::string> header_lines;
         std::string                                  body;
 
+        // A body sent straight from a file instead of `body'
+        int         body_file      = -1;
+        std::size_t body_file_size = 0;
+
     public:
         Response() {}
+        Response(const Response &)             = delete;
+        Response & operator=(const Response &) = delete;
+        ~Response() { ClearBody(); }
 
         /**
          * @brief Set one header line with key-value pair
@@ -148,7 +178,31 @@ private:
         /**
          *@brief Clear the response body
          */
-        void ClearBody() { body.clear(); }
+        void ClearBody();
+
+        /**
+         *@brief Use an open file as the body so it can be sent without
+         * copying it through memory
+         *
+         * @param fd the file, owned by the response from now on
+         * @param size the number of bytes to send from the start of the file
+         */
+        void SetBodyFile(int fd, std::size_t size);
+
+        bool        HasBodyFile() const { return body_file >= 0; }
+        std::size_t GetBodyFileSize() const { return body_file_size; }
+
+        /**
+         *@brief Release the body file to the caller
+         *
+         * @return int the file descriptor, or -1 if the body is in memory
+         */
+        int TakeBodyFile();
+
+        /**
+         *@brief Read the body file into memory, e.g. to compress it
+         */
+        void LoadBodyFile();
 
         /**
          *@brief Clear the response
@@ -157,6 +211,7 @@ private:
         {
             ClearHeaderLine();
             ClearBody();
+            SetStatusCode(200);
         }
 
         /**
@@ -166,6 +221,14 @@ private:
 
         const std::string & GetResponse() const { return response; }
 
+        int GetStatusCode() const { return status_line.status_code; }
+
+        const std::unordered_map<std::string, std::string> &
+        GetHeaderLines() const
+        {
+            return header_lines;
+        }
+
         /**
          *@brief Get the response body
          *
@@ -195,6 +258,24 @@ public:
         request = std::make_unique<Request>(msg);
     }
 
+    /**
+     *@brief Get the body length a request head announces
+     *
+     * @param head the request line and headers, ending with the empty line
+     * @return std::optional<std::uint64_t> the `Content-Length', 0 without
+     * one, or nothing if it is repeated or not a decimal number
+     */
+    static std::optional<std::uint64_t> ContentLength(std::string_view head);
+
+    /**
+     *@brief Get the length of the request line and headers of the first
+     * request in `data', including the empty line
+     *
+     * @param data the data received so far
+     * @return std::size_t the length of the head, or 0 if more data is needed
+     */
+    static std::size_t HeadLength(std::string_view data);
+
     const std::unique_ptr<Request> & GetRequestPointer() const
     {
         return request;
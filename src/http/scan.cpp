@@ -0,0 +1,182 @@
+#include "scan.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/**
+ *@brief Check whether the byte is an RFC 9110 `tchar'
+ */
+static constexpr bool isTokenCharacter(unsigned char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+           (c >= 'a' && c <= 'z') || std::string_view("!#$%&'*+-.^_`|~")
+                                             .find(static_cast<char>(c)) !=
+                                         std::string_view::npos;
+}
+
+/**
+ * Nibble lookup tables for the vectorized header name check.
+ * A byte `c' is a token character iff
+ * `LOW_NIBBLE_TABLE[c & 0xf] & HIGH_NIBBLE_TABLE[c >> 4]' is non-zero.
+ */
+static constexpr std::array<std::uint8_t, 16> LOW_NIBBLE_TABLE = []() {
+    std::array<std::uint8_t, 16> table{};
+    for (int high = 0; high < 8; high++)
+        for (int low = 0; low < 16; low++)
+            if (isTokenCharacter(static_cast<unsigned char>(high << 4 | low)))
+                table[low] |= static_cast<std::uint8_t>(1 << high);
+    return table;
+}();
+
+static constexpr std::array<std::uint8_t, 16> HIGH_NIBBLE_TABLE = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/**
+ * Token characters by byte value, for the scalar check and the tails the
+ * vector kernels leave; most header names are shorter than one vector
+ */
+static constexpr std::array<bool, 256> TOKEN_TABLE = []() {
+    std::array<bool, 256> table{};
+    for (int c = 0; c < 256; c++)
+        table[c] = isTokenCharacter(static_cast<unsigned char>(c));
+    return table;
+}();
+
+static bool validHeaderNameScalar(const char * data, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; i++)
+        if (!TOKEN_TABLE[static_cast<unsigned char>(data[i])])
+            return false;
+
+    return true;
+}
+
+#ifdef SCAN_X86
+
+__attribute__((target("ssse3"))) static bool
+validHeaderNameSSSE3(const char * data, std::size_t size)
+{
+    // Most names are shorter than a vector
+    if (size < 16)
+        return validHeaderNameScalar(data, size);
+
+    const __m128i low_table =
+        _mm_loadu_si128((const __m128i *) LOW_NIBBLE_TABLE.data());
+    const __m128i high_table =
+        _mm_loadu_si128((const __m128i *) HIGH_NIBBLE_TABLE.data());
+    const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+    std::size_t   i           = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i low   = _mm_shuffle_epi8(low_table,
+                                         _mm_and_si128(chunk, nibble_mask));
+        __m128i high  = _mm_shuffle_epi8(
+            high_table, _mm_and_si128(_mm_srli_epi16(chunk, 4), nibble_mask));
+        __m128i hit   = _mm_and_si128(low, high);
+
+        // Any zero lane is a byte outside the token set
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(hit, _mm_setzero_si128())) != 0)
+            return false;
+    }
+
+    return validHeaderNameScalar(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) static bool
+validHeaderNameAVX2(const char * data, std::size_t size)
+{
+    if (size < 32)
+        return validHeaderNameSSSE3(data, size);
+
+    const __m256i low_table = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) LOW_NIBBLE_TABLE.data()));
+    const __m256i high_table = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) HIGH_NIBBLE_TABLE.data()));
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+    std::size_t   i           = 0;
+
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) (data + i));
+        __m256i low   = _mm256_shuffle_epi8(
+            low_table, _mm256_and_si256(chunk, nibble_mask));
+        __m256i high = _mm256_shuffle_epi8(
+            high_table,
+            _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble_mask));
+        __m256i hit = _mm256_and_si256(low, high);
+
+        if (_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(hit, _mm256_setzero_si256())) != 0)
+            return false;
+    }
+
+    // GCC turns this into a jump without clearing the upper halves, and
+    // the SSE code behind it would then pay for every instruction
+    _mm256_zeroupper();
+
+    return validHeaderNameSSSE3(data + i, size - i);
+}
+
+#endif // SCAN_X86
+
+scan::HeaderNameKernel scan::HeaderNameKernelOf(Kernel kernel)
+{
+#ifdef SCAN_X86
+    // `pshufb' needs SSSE3, the other instructions are SSE2
+    if (kernel == scan::Kernel::AVX2 && __builtin_cpu_supports("avx2"))
+        return validHeaderNameAVX2;
+    if (kernel == scan::Kernel::SSSE3 && __builtin_cpu_supports("ssse3"))
+        return validHeaderNameSSSE3;
+#endif
+
+    return kernel == scan::Kernel::SCALAR ? validHeaderNameScalar : nullptr;
+}
+
+static const char * const KERNEL_NAMES[] = {"scalar", "ssse3", "avx2"};
+
+/**
+ * The kernel used by this process, selected once before `main()'
+ */
+static const scan::Kernel KERNEL = []() {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+#endif
+
+    for (scan::Kernel kernel : {scan::Kernel::AVX2, scan::Kernel::SSSE3})
+        if (scan::HeaderNameKernelOf(kernel))
+            return kernel;
+
+    return scan::Kernel::SCALAR;
+}();
+
+static const scan::HeaderNameKernel HEADER_NAME_KERNEL =
+    scan::HeaderNameKernelOf(KERNEL);
+
+std::size_t scan::FindByte(std::string_view data, char byte)
+{
+    // glibc already picks a vector memchr for the CPU, which outran our
+    // SSSE3 and AVX2 search at every length in `scan_bench' 
+    const void * found = std::memchr(data.data(), byte, data.size());
+
+    return found ? static_cast<const char *>(found) - data.data()
+                 : std::string_view::npos;
+}
+
+bool scan::IsValidHeaderName(std::string_view name)
+{
+    return !name.empty() && HEADER_NAME_KERNEL(name.data(), name.size());
+}
+
+const char * scan::KernelName()
+{
+    return KERNEL_NAMES[static_cast<int>(KERNEL)];
+}
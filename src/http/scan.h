@@ -0,0 +1,66 @@
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <cstddef>
+#include <string_view>
+
+#define BEGIN_SCAN_NAMESPACE \
+    namespace scan           \
+    {
+#define END_SCAN_NAMESPACE }
+
+BEGIN_SCAN_NAMESPACE
+
+enum class Kernel
+{
+    SCALAR,
+    SSSE3,
+    AVX2,
+};
+
+/**
+ *@brief Find the first occurrence of `byte' in `data'
+ *
+ * @param data the data to scan
+ * @param byte the delimiter to look for
+ * @return std::size_t the position of the delimiter, or
+ * `std::string_view::npos' if it does not appear
+ */
+std::size_t FindByte(std::string_view data, char byte);
+
+/**
+ *@brief Check whether `name' is a valid header field name, i.e. a non-empty
+ * sequence of RFC 9110 `tchar'
+ *
+ * The kernel is chosen once at startup: AVX2 or SSSE3 when the CPU supports
+ * them, otherwise a scalar fallback.
+ *
+ * @param name the header name
+ * @return true every byte is a token character
+ * @return false the name is empty or contains a non-token byte
+ */
+bool IsValidHeaderName(std::string_view name);
+
+/**
+ *@brief Get the name of the kernel selected for this CPU
+ *
+ * @return const char* `avx2', `ssse3' or `scalar'
+ */
+const char * KernelName();
+
+/**
+ *@brief A header name check over `size' bytes, which must not be 0
+ */
+using HeaderNameKernel = bool (*)(const char * data, std::size_t size);
+
+/**
+ *@brief Get the header name check of a kernel, e.g. to test or benchmark it
+ *
+ * @return HeaderNameKernel the check, or nullptr if this CPU cannot run the
+ * kernel; the scalar one always runs
+ */
+HeaderNameKernel HeaderNameKernelOf(Kernel kernel);
+
+END_SCAN_NAMESPACE
+
+#endif // !_SCAN_H_
@@ -0,0 +1,541 @@
+#include "hpack.h"
+#include <algorithm>
+#include <array>
+
+// clang-format off
+static const http2::Header STATIC_TABLE[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+static constexpr std::uint32_t HUFFMAN_CODES[256] = {
+    0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5,
+    0x0fffffe6, 0x0fffffe7, 0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9,
+    0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec, 0x0fffffed, 0x0fffffee,
+    0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+    0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9,
+    0x0ffffffa, 0x0ffffffb, 0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa,
+    0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa, 0x000003fa, 0x000003fb,
+    0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+    0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b,
+    0x0000001c, 0x0000001d, 0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb,
+    0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc, 0x00001ffa, 0x00000021,
+    0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+    0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068,
+    0x00000069, 0x0000006a, 0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e,
+    0x0000006f, 0x00000070, 0x00000071, 0x00000072, 0x000000fc, 0x00000073,
+    0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+    0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005,
+    0x00000025, 0x00000026, 0x00000027, 0x00000006, 0x00000074, 0x00000075,
+    0x00000028, 0x00000029, 0x0000002a, 0x00000007, 0x0000002b, 0x00000076,
+    0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+    0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd,
+    0x00001ffd, 0x0ffffffc, 0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8,
+    0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9, 0x003fffd6, 0x007fffda,
+    0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+    0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1,
+    0x007fffe2, 0x007fffe3, 0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5,
+    0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef, 0x003fffda, 0x001fffdd,
+    0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+    0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf,
+    0x007fffeb, 0x007fffec, 0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2,
+    0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef, 0x000fffea, 0x003fffe2,
+    0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+    0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2,
+    0x003fffe8, 0x01ffffec, 0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde,
+    0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed, 0x0007fff2, 0x001fffe3,
+    0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+    0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3,
+    0x07ffffe4, 0x07ffffe5, 0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6,
+    0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3, 0x003fffea, 0x003fffeb,
+    0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+    0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8,
+    0x07ffffe9, 0x07ffffea, 0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed,
+    0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee,
+};
+
+static constexpr std::uint8_t HUFFMAN_CODE_LENGTHS[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+// clang-format on
+
+constexpr std::size_t STATIC_TABLE_SIZE =
+    sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+/**
+ * Canonical Huffman decoding tables: codes of the same length are
+ * consecutive, so a code of length `l' decodes to
+ * `SYMBOLS[offset[l] + code - first_code[l]]' when it is below
+ * `first_code[l] + count[l]'.
+ */
+static const struct HuffmanDecodeTable
+{
+    std::array<std::uint32_t, 31> first_code{};
+    std::array<std::uint32_t, 31> count{};
+    std::array<std::uint32_t, 31> offset{};
+    std::array<std::uint8_t, 256> symbols{};
+} HUFFMAN_DECODE_TABLE = []() {
+    HuffmanDecodeTable table;
+    std::array<int, 256> order;
+
+    for (int i = 0; i < 256; i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [](int a, int b) {
+        return HUFFMAN_CODE_LENGTHS[a] != HUFFMAN_CODE_LENGTHS[b]
+                   ? HUFFMAN_CODE_LENGTHS[a] < HUFFMAN_CODE_LENGTHS[b]
+                   : HUFFMAN_CODES[a] < HUFFMAN_CODES[b];
+    });
+
+    for (int i = 0; i < 256; i++)
+    {
+        int symbol = order[i];
+        int length = HUFFMAN_CODE_LENGTHS[symbol];
+
+        if (table.count[length]++ == 0)
+        {
+            table.first_code[length] = HUFFMAN_CODES[symbol];
+            table.offset[length]     = i;
+        }
+        table.symbols[i] = static_cast<std::uint8_t>(symbol);
+    }
+
+    return table;
+}();
+
+static std::string huffmanDecode(std::string_view data)
+{
+    std::string   decoded;
+    std::uint32_t code   = 0;
+    int           length = 0;
+
+    for (unsigned char byte : data)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            code = code << 1 | ((byte >> bit) & 1);
+            length++;
+
+            if (length > 30)
+                throw http2::HpackException("invalid huffman code");
+
+            if (HUFFMAN_DECODE_TABLE.count[length] != 0 &&
+                code >= HUFFMAN_DECODE_TABLE.first_code[length] &&
+                code - HUFFMAN_DECODE_TABLE.first_code[length] <
+                    HUFFMAN_DECODE_TABLE.count[length])
+            {
+                decoded.push_back(static_cast<char>(
+                    HUFFMAN_DECODE_TABLE
+                        .symbols[HUFFMAN_DECODE_TABLE.offset[length] + code -
+                                 HUFFMAN_DECODE_TABLE.first_code[length]]));
+                code   = 0;
+                length = 0;
+            }
+        }
+    }
+
+    // The padding must be a prefix of EOS, i.e. fewer than 8 one bits
+    if (length > 7 || code != (1u << length) - 1)
+        throw http2::HpackException("invalid huffman padding");
+
+    return decoded;
+}
+
+static std::size_t huffmanEncodedLength(std::string_view data)
+{
+    std::size_t bits = 0;
+
+    for (unsigned char c : data) bits += HUFFMAN_CODE_LENGTHS[c];
+
+    return (bits + 7) / 8;
+}
+
+static void huffmanEncode(std::string_view data, std::string & out)
+{
+    std::uint64_t buffer = 0;
+    int           bits   = 0;
+
+    for (unsigned char c : data)
+    {
+        buffer = buffer << HUFFMAN_CODE_LENGTHS[c] | HUFFMAN_CODES[c];
+        bits += HUFFMAN_CODE_LENGTHS[c];
+
+        while (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back(static_cast<char>(buffer >> bits));
+        }
+    }
+
+    // Pad with the most significant bits of EOS
+    if (bits > 0)
+        out.push_back(static_cast<char>(buffer << (8 - bits) |
+                                        (0xff >> bits)));
+
+    return;
+}
+
+/**
+ *@brief Decode an HPACK integer with an `prefix_bits' bit prefix
+ *
+ * @param block the remaining block, advanced past the integer
+ * @param prefix_bits the number of bits of the first byte used
+ * @return std::size_t the value
+ */
+static std::size_t decodeInteger(std::string_view & block, int prefix_bits)
+{
+    if (block.empty())
+        throw http2::HpackException("truncated integer");
+
+    std::size_t mask  = (1u << prefix_bits) - 1;
+    std::size_t value = static_cast<unsigned char>(block[0]) & mask;
+    block.remove_prefix(1);
+
+    if (value < mask)
+        return value;
+
+    for (int shift = 0;; shift += 7)
+    {
+        if (block.empty() || shift > 28)
+            throw http2::HpackException("invalid integer");
+
+        unsigned char byte = static_cast<unsigned char>(block[0]);
+        block.remove_prefix(1);
+        value += static_cast<std::size_t>(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80))
+            return value;
+    }
+}
+
+static void encodeInteger(std::size_t value, int prefix_bits,
+                          unsigned char flags, std::string & out)
+{
+    std::size_t mask = (1u << prefix_bits) - 1;
+
+    if (value < mask)
+    {
+        out.push_back(static_cast<char>(flags | value));
+        return;
+    }
+
+    out.push_back(static_cast<char>(flags | mask));
+    for (value -= mask; value >= 0x80; value >>= 7)
+        out.push_back(static_cast<char>(0x80 | (value & 0x7f)));
+    out.push_back(static_cast<char>(value));
+
+    return;
+}
+
+static std::string decodeString(std::string_view & block)
+{
+    if (block.empty())
+        throw http2::HpackException("truncated string");
+
+    bool        huffman = block[0] & 0x80;
+    std::size_t length  = decodeInteger(block, 7);
+
+    if (length > block.size())
+        throw http2::HpackException("truncated string");
+
+    std::string_view data = block.substr(0, length);
+    block.remove_prefix(length);
+
+    return huffman ? huffmanDecode(data) : std::string(data);
+}
+
+static void encodeString(std::string_view data, std::string & out)
+{
+    std::size_t huffman_length = huffmanEncodedLength(data);
+
+    if (huffman_length < data.size())
+    {
+        encodeInteger(huffman_length, 7, 0x80, out);
+        huffmanEncode(data, out);
+    }
+    else
+    {
+        encodeInteger(data.size(), 7, 0x00, out);
+        out.append(data);
+    }
+
+    return;
+}
+
+static std::size_t entrySize(const http2::Header & header)
+{
+    return header.first.size() + header.second.size() + 32;
+}
+
+void http2::DynamicTable::Evict(std::size_t limit)
+{
+    while (size > limit)
+    {
+        size -= entrySize(entries.back());
+        entries.pop_back();
+    }
+
+    return;
+}
+
+void http2::DynamicTable::Add(const Header & header)
+{
+    // An entry larger than the table empties it (RFC 7541 §4.4)
+    Evict(max_size - std::min(max_size, entrySize(header)));
+
+    if (entrySize(header) <= max_size)
+    {
+        entries.push_front(header);
+        size += entrySize(header);
+    }
+
+    return;
+}
+
+void http2::DynamicTable::Resize(std::size_t new_max_size)
+{
+    max_size = new_max_size;
+    Evict(max_size);
+
+    return;
+}
+
+const http2::Header * http2::DynamicTable::At(std::size_t index) const
+{
+    if (index == 0)
+        return nullptr;
+
+    if (index <= STATIC_TABLE_SIZE)
+        return &STATIC_TABLE[index - 1];
+
+    index -= STATIC_TABLE_SIZE + 1;
+
+    return index < entries.size() ? &entries[index] : nullptr;
+}
+
+std::size_t http2::DynamicTable::Find(const Header & header,
+                                      bool &         name_only) const
+{
+    std::size_t name_index = 0;
+
+    for (std::size_t i = 0; i < STATIC_TABLE_SIZE; i++)
+    {
+        if (STATIC_TABLE[i].first != header.first)
+            continue;
+
+        if (STATIC_TABLE[i].second == header.second)
+        {
+            name_only = false;
+            return i + 1;
+        }
+
+        if (name_index == 0)
+            name_index = i + 1;
+    }
+
+    for (std::size_t i = 0; i < entries.size(); i++)
+    {
+        if (entries[i].first != header.first)
+            continue;
+
+        if (entries[i].second == header.second)
+        {
+            name_only = false;
+            return STATIC_TABLE_SIZE + 1 + i;
+        }
+
+        if (name_index == 0)
+            name_index = STATIC_TABLE_SIZE + 1 + i;
+    }
+
+    name_only = true;
+
+    return name_index;
+}
+
+std::vector<http2::Header> http2::HpackDecoder::Decode(std::string_view block,
+                                                  std::size_t max_list_size)
+{
+    std::vector<Header> headers;
+    std::size_t         list_size = 0;
+
+    // Indexed fields repeat table entries for a byte each, so the list is
+    // bounded as it grows rather than once decoded
+    auto add = [&](Header header) {
+        list_size += entrySize(header);
+        if (list_size > max_list_size)
+            throw HeaderListSizeException();
+
+        headers.push_back(std::move(header));
+    };
+
+    while (!block.empty())
+    {
+        unsigned char byte = static_cast<unsigned char>(block[0]);
+
+        // Indexed header field
+        if (byte & 0x80)
+        {
+            const Header * header = table.At(decodeInteger(block, 7));
+
+            if (header == nullptr)
+                throw HpackException("invalid header index");
+
+            add(*header);
+            continue;
+        }
+
+        // Dynamic table size update
+        if ((byte & 0xe0) == 0x20)
+        {
+            std::size_t size = decodeInteger(block, 5);
+
+            if (size > max_table_size)
+                throw HpackException("table size update too large");
+
+            table.Resize(size);
+            continue;
+        }
+
+        // Literal with incremental indexing, without indexing, never indexed
+        bool        indexing   = byte & 0x40;
+        std::size_t name_index = decodeInteger(block, indexing ? 6 : 4);
+        Header      header;
+
+        if (name_index == 0)
+            header.first = decodeString(block);
+        else if (const Header * named = table.At(name_index))
+            header.first = named->first;
+        else
+            throw HpackException("invalid name index");
+
+        header.second = decodeString(block);
+
+        if (indexing)
+            table.Add(header);
+
+        add(std::move(header));
+    }
+
+    return headers;
+}
+
+void http2::HpackEncoder::SetMaxTableSize(std::size_t size)
+{
+    size = std::min(size, DEFAULT_HEADER_TABLE_SIZE);
+
+    if (size != table.GetMaxSize())
+    {
+        table.Resize(size);
+        size_update_pending = true;
+    }
+
+    return;
+}
+
+void http2::HpackEncoder::Encode(const std::vector<Header> & headers,
+                                 std::string &               out)
+{
+    if (size_update_pending)
+    {
+        encodeInteger(table.GetMaxSize(), 5, 0x20, out);
+        size_update_pending = false;
+    }
+
+    for (const Header & header : headers)
+    {
+        bool        name_only;
+        std::size_t index = table.Find(header, name_only);
+
+        if (index != 0 && !name_only)
+        {
+            encodeInteger(index, 7, 0x80, out);
+            continue;
+        }
+
+        // Large values would only churn the table
+        bool indexing = entrySize(header) <= table.GetMaxSize() / 4;
+
+        encodeInteger(index, indexing ? 6 : 4, indexing ? 0x40 : 0x00, out);
+        if (index == 0)
+            encodeString(header.first, out);
+        encodeString(header.second, out);
+
+        if (indexing)
+            table.Add(header);
+    }
+
+    return;
+}
@@ -0,0 +1,137 @@
+#ifndef _HPACK_H_
+#define _HPACK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#define BEGIN_HTTP2_NAMESPACE \
+    namespace http2           \
+    {
+#define END_HTTP2_NAMESPACE }
+
+BEGIN_HTTP2_NAMESPACE
+
+using Header = std::pair<std::string, std::string>;
+
+/**
+ *@brief The header table size both peers start with (RFC 7541 §4.2)
+ */
+constexpr std::size_t DEFAULT_HEADER_TABLE_SIZE = 4096;
+
+class HpackException : public std::exception
+{
+private:
+    std::string message;
+
+public:
+    explicit HpackException(const std::string & msg) : message(msg) {}
+
+    const char * what() const noexcept override { return message.c_str(); }
+};
+
+/**
+ *@brief A header block decodes to more than the header list size allowed
+ */
+class HeaderListSizeException : public HpackException
+{
+public:
+    HeaderListSizeException() : HpackException("header list too large") {}
+};
+
+/**
+ *@brief The HPACK dynamic table, newest entry first
+ */
+class DynamicTable
+{
+private:
+    std::deque<Header> entries;
+    std::size_t        size     = 0; /* Sum of entry sizes, see RFC 7541 §4.1 */
+    std::size_t        max_size = DEFAULT_HEADER_TABLE_SIZE;
+
+    /**
+     *@brief Evict the oldest entries until the table fits in `limit'
+     */
+    void Evict(std::size_t limit);
+
+public:
+    /**
+     *@brief Insert an entry, evicting old ones to make room
+     */
+    void Add(const Header & header);
+
+    /**
+     *@brief Change the maximum size of the table
+     */
+    void Resize(std::size_t new_max_size);
+
+    /**
+     *@brief Look up an entry by HPACK index (static entries come first)
+     *
+     * @param index the 1-based index
+     * @return const Header* the entry, or nullptr if out of range
+     */
+    const Header * At(std::size_t index) const;
+
+    /**
+     *@brief Find the best index for a header
+     *
+     * @param header the header to look for
+     * @param name_only set to true if only the name matched
+     * @return std::size_t the index, or 0 if the name is unknown
+     */
+    std::size_t Find(const Header & header, bool & name_only) const;
+
+    std::size_t GetMaxSize() const { return max_size; }
+};
+
+class HpackDecoder
+{
+private:
+    DynamicTable table;
+    std::size_t  max_table_size = DEFAULT_HEADER_TABLE_SIZE;
+
+public:
+    /**
+     *@brief Decode a complete header block
+     *
+     * @param block the concatenated HEADERS and CONTINUATION fragments
+     * @param max_list_size the largest header list accepted, counted as in
+     * RFC 9113 §6.5.2
+     * @return std::vector<Header> the decoded headers, in order
+     * @throw HpackException the block is malformed
+     * @throw HeaderListSizeException the list is larger than `max_list_size'
+     */
+    std::vector<Header> Decode(std::string_view block,
+                               std::size_t max_list_size = SIZE_MAX);
+};
+
+class HpackEncoder
+{
+private:
+    DynamicTable table;
+    bool         size_update_pending = false;
+
+public:
+    /**
+     *@brief Follow the peer's SETTINGS_HEADER_TABLE_SIZE
+     */
+    void SetMaxTableSize(std::size_t size);
+
+    /**
+     *@brief Encode a header block
+     *
+     * @param headers the headers, with lowercase names
+     * @param out where to append the block
+     */
+    void Encode(const std::vector<Header> & headers, std::string & out);
+};
+
+END_HTTP2_NAMESPACE
+
+#endif // !_HPACK_H_
@@ -0,0 +1,898 @@
+#include "session.h"
+#include <algorithm>
+#include <cerrno>
+#include <exception>
+#include <unistd.h>
+
+enum SettingsParameter : std::uint16_t
+{
+    SETTINGS_HEADER_TABLE_SIZE      = 0x1,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    SETTINGS_INITIAL_WINDOW_SIZE    = 0x4,
+    SETTINGS_MAX_FRAME_SIZE         = 0x5,
+    SETTINGS_MAX_HEADER_LIST_SIZE   = 0x6,
+};
+
+constexpr std::size_t FRAME_HEADER_LENGTH = 9;
+
+static std::uint32_t readUint32(std::string_view data)
+{
+    return static_cast<std::uint32_t>(static_cast<unsigned char>(data[0]))
+               << 24 |
+           static_cast<std::uint32_t>(static_cast<unsigned char>(data[1]))
+               << 16 |
+           static_cast<std::uint32_t>(static_cast<unsigned char>(data[2]))
+               << 8 |
+           static_cast<std::uint32_t>(static_cast<unsigned char>(data[3]));
+}
+
+static void appendUint32(std::uint32_t value, std::string & out)
+{
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+/**
+ *@brief Decode the base64url `HTTP2-Settings' header (RFC 7540 §3.2.1)
+ *
+ * @param encoded the header value, with or without padding
+ * @return std::string the SETTINGS payload
+ */
+static std::string decodeBase64Url(std::string_view encoded)
+{
+    std::string   decoded;
+    std::uint32_t buffer = 0;
+    int           bits   = 0;
+
+    for (char c : encoded)
+    {
+        int value;
+
+        if (c >= 'A' && c <= 'Z')
+            value = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            value = c - '0' + 52;
+        else if (c == '-' || c == '+')
+            value = 62;
+        else if (c == '_' || c == '/')
+            value = 63;
+        else
+            continue; /* Padding */
+
+        buffer = buffer << 6 | value;
+        bits += 6;
+
+        if (bits >= 8)
+        {
+            bits -= 8;
+            decoded.push_back(static_cast<char>(buffer >> bits));
+        }
+    }
+
+    return decoded;
+}
+
+/**
+ *@brief Strip the padding of a PADDED frame
+ *
+ * @param payload the frame payload, trimmed in place
+ * @return true the padding is well-formed
+ */
+static bool removePadding(std::string_view & payload)
+{
+    if (payload.empty())
+        return false;
+
+    std::size_t padding = static_cast<unsigned char>(payload[0]);
+    payload.remove_prefix(1);
+
+    if (padding > payload.size())
+        return false;
+
+    payload.remove_suffix(padding);
+
+    return true;
+}
+
+http2::Session::Stream::~Stream()
+{
+    if (body_file >= 0)
+        close(body_file);
+}
+
+void http2::Session::WriteFrame(std::uint8_t type, std::uint8_t flags,
+                                std::uint32_t    stream_id,
+                                std::string_view payload)
+{
+    output.push_back(static_cast<char>(payload.size() >> 16));
+    output.push_back(static_cast<char>(payload.size() >> 8));
+    output.push_back(static_cast<char>(payload.size()));
+    output.push_back(static_cast<char>(type));
+    output.push_back(static_cast<char>(flags));
+    appendUint32(stream_id & 0x7fffffff, output);
+    output.append(payload);
+
+    return;
+}
+
+void http2::Session::WriteSettings()
+{
+    std::string payload;
+
+    auto add = [&payload](std::uint16_t id, std::uint32_t value) {
+        payload.push_back(static_cast<char>(id >> 8));
+        payload.push_back(static_cast<char>(id));
+        appendUint32(value, payload);
+    };
+
+    add(SETTINGS_MAX_CONCURRENT_STREAMS, MAX_CONCURRENT_STREAMS);
+    add(SETTINGS_INITIAL_WINDOW_SIZE, LOCAL_WINDOW_SIZE);
+    add(SETTINGS_MAX_HEADER_LIST_SIZE, MAX_HEADER_LIST_SIZE);
+
+    WriteFrame(SETTINGS, 0, 0, payload);
+
+    // The connection window bounds the request bodies buffered at once
+    std::int64_t window = std::clamp<std::int64_t>(
+        max_request_body, DEFAULT_WINDOW_SIZE, MAX_WINDOW_SIZE);
+    if (window > DEFAULT_WINDOW_SIZE)
+        WriteWindowUpdate(0, window - DEFAULT_WINDOW_SIZE);
+    receive_window = window;
+
+    return;
+}
+
+void http2::Session::WriteWindowUpdate(std::uint32_t stream_id,
+                                       std::uint32_t increment)
+{
+    std::string payload;
+    appendUint32(increment, payload);
+    WriteFrame(WINDOW_UPDATE, 0, stream_id, payload);
+
+    return;
+}
+
+void http2::Session::ResetStream(std::uint32_t stream_id, ErrorCode code)
+{
+    std::string payload;
+    appendUint32(code, payload);
+    WriteFrame(RST_STREAM, 0, stream_id, payload);
+
+    auto it = streams.find(stream_id);
+    if (it != streams.end())
+        EraseStream(it);
+
+    return;
+}
+
+std::map<std::uint32_t, http2::Session::Stream>::iterator
+http2::Session::EraseStream(std::map<std::uint32_t, Stream>::iterator it)
+{
+    buffered_body -= it->second.request_body.size();
+    ReplenishWindow(it->second.request_body.size());
+
+    return streams.erase(it);
+}
+
+void http2::Session::ReplenishWindow(std::size_t length)
+{
+    if (length == 0 || closed)
+        return;
+
+    receive_window += length;
+    WriteWindowUpdate(0, length);
+
+    return;
+}
+
+void http2::Session::ConnectionError(ErrorCode code)
+{
+    std::string payload;
+    appendUint32(last_stream_id, payload);
+    appendUint32(code, payload);
+    WriteFrame(GOAWAY, 0, 0, payload);
+
+    closed = true;
+
+    return;
+}
+
+void http2::Session::Start()
+{
+    WriteSettings();
+
+    return;
+}
+
+void http2::Session::StartUpgraded(std::string_view            settings,
+                                   const std::vector<Header> & headers,
+                                   const std::string &         body)
+{
+    WriteSettings();
+
+    // The upgrade request carries the client's initial SETTINGS, which are
+    // acknowledged implicitly by the 101 response
+    ProcessSettings(0, decodeBase64Url(settings), false);
+
+    Stream & stream         = streams[1];
+    stream.headers          = headers;
+    stream.request_body     = body;
+    stream.request_complete = true;
+    stream.send_window      = peer_initial_window;
+    last_stream_id          = 1;
+
+    Respond(1);
+
+    return;
+}
+
+void http2::Session::Feed(std::string_view data)
+{
+    input.append(data);
+
+    std::string_view rest = input;
+
+    if (!preface_received)
+    {
+        if (rest.size() < CLIENT_PREFACE.size())
+            return;
+
+        if (!rest.starts_with(CLIENT_PREFACE))
+        {
+            ConnectionError(PROTOCOL_ERROR);
+            return;
+        }
+
+        rest.remove_prefix(CLIENT_PREFACE.size());
+        preface_received = true;
+    }
+
+    while (!closed && rest.size() >= FRAME_HEADER_LENGTH)
+    {
+        std::size_t length =
+            static_cast<std::size_t>(static_cast<unsigned char>(rest[0]))
+                << 16 |
+            static_cast<std::size_t>(static_cast<unsigned char>(rest[1]))
+                << 8 |
+            static_cast<std::size_t>(static_cast<unsigned char>(rest[2]));
+
+        if (length > LOCAL_MAX_FRAME)
+        {
+            ConnectionError(FRAME_SIZE_ERROR);
+            return;
+        }
+
+        if (rest.size() < FRAME_HEADER_LENGTH + length)
+            break;
+
+        std::uint8_t  type      = static_cast<std::uint8_t>(rest[3]);
+        std::uint8_t  flags     = static_cast<std::uint8_t>(rest[4]);
+        std::uint32_t stream_id = readUint32(rest.substr(5)) & 0x7fffffff;
+
+        ProcessFrame(type, flags, stream_id,
+                     rest.substr(FRAME_HEADER_LENGTH, length));
+        rest.remove_prefix(FRAME_HEADER_LENGTH + length);
+    }
+
+    if (closed)
+    {
+        input.clear();
+        return;
+    }
+
+    input.erase(0, input.size() - rest.size());
+
+    return;
+}
+
+void http2::Session::GoAway()
+{
+    if (going_away || closed)
+        return;
+
+    std::string payload;
+    appendUint32(last_stream_id, payload);
+    appendUint32(NO_ERROR, payload);
+    WriteFrame(GOAWAY, 0, 0, payload);
+
+    going_away = true;
+
+    return;
+}
+
+std::string http2::Session::TakeOutput(std::size_t limit)
+{
+    if (!closed)
+        ScheduleData(limit);
+
+    std::string taken;
+    taken.swap(output);
+
+    return taken;
+}
+
+bool http2::Session::HasPendingData() const
+{
+    if (closed || connection_send_window <= 0)
+        return false;
+
+    for (const auto & [stream_id, stream] : streams)
+        if (stream.responded && stream.send_window > 0)
+            return true;
+
+    return false;
+}
+
+void http2::Session::ProcessFrame(std::uint8_t type, std::uint8_t flags,
+                                  std::uint32_t    stream_id,
+                                  std::string_view payload)
+{
+    // A header block must not be interleaved with other frames
+    if (continuation_stream != 0 &&
+        (type != CONTINUATION || stream_id != continuation_stream))
+    {
+        ConnectionError(PROTOCOL_ERROR);
+        return;
+    }
+
+    switch (type)
+    {
+    case DATA:
+        ProcessData(flags, stream_id, payload);
+        break;
+
+    case HEADERS:
+        ProcessHeaders(flags, stream_id, payload);
+        break;
+
+    case CONTINUATION:
+        if (continuation_stream == 0)
+        {
+            ConnectionError(PROTOCOL_ERROR);
+            break;
+        }
+
+        if (!AppendHeaderBlock(stream_id, payload))
+            break;
+
+        if (flags & END_HEADERS)
+        {
+            continuation_stream = 0;
+            FinishHeaderBlock(stream_id, continuation_end_stream);
+        }
+        break;
+
+    case SETTINGS:
+        if (stream_id != 0)
+            ConnectionError(PROTOCOL_ERROR);
+        else
+            ProcessSettings(flags, payload);
+        break;
+
+    case PING:
+        if (stream_id != 0 || payload.size() != 8)
+            ConnectionError(payload.size() != 8 ? FRAME_SIZE_ERROR
+                                                : PROTOCOL_ERROR);
+        else if (!(flags & ACK))
+            WriteFrame(PING, ACK, 0, payload);
+        break;
+
+    case WINDOW_UPDATE:
+        ProcessWindowUpdate(stream_id, payload);
+        break;
+
+    case RST_STREAM:
+        if (stream_id == 0 || payload.size() != 4)
+            ConnectionError(PROTOCOL_ERROR);
+        else if (auto it = streams.find(stream_id); it != streams.end())
+            EraseStream(it);
+        break;
+
+    case GOAWAY:
+        // Let open streams finish, then close
+        going_away = true;
+        break;
+
+    case PUSH_PROMISE: /* Clients must not push */
+        ConnectionError(PROTOCOL_ERROR);
+        break;
+
+    default: /* PRIORITY and unknown frames are ignored */
+        break;
+    }
+
+    return;
+}
+
+void http2::Session::ProcessHeaders(std::uint8_t flags, std::uint32_t stream_id,
+                                    std::string_view payload)
+{
+    if (stream_id == 0 || stream_id % 2 == 0)
+    {
+        ConnectionError(PROTOCOL_ERROR);
+        return;
+    }
+
+    if ((flags & PADDED) && !removePadding(payload))
+    {
+        ConnectionError(PROTOCOL_ERROR);
+        return;
+    }
+
+    if (flags & PRIORITY_FLAG)
+    {
+        if (payload.size() < 5)
+        {
+            ConnectionError(FRAME_SIZE_ERROR);
+            return;
+        }
+        payload.remove_prefix(5);
+    }
+
+    auto existing = streams.find(stream_id);
+
+    if (existing != streams.end())
+    {
+        // Trailers must end the stream
+        if (existing->second.request_complete || !(flags & END_STREAM))
+        {
+            ConnectionError(PROTOCOL_ERROR);
+            return;
+        }
+    }
+    else if (stream_id <= last_stream_id)
+    {
+        ConnectionError(STREAM_CLOSED);
+        return;
+    }
+    else
+    {
+        last_stream_id = stream_id;
+        streams[stream_id].send_window = peer_initial_window;
+    }
+
+    if (!AppendHeaderBlock(stream_id, payload))
+        return;
+
+    if (flags & END_HEADERS)
+        FinishHeaderBlock(stream_id, flags & END_STREAM);
+    else
+    {
+        continuation_stream     = stream_id;
+        continuation_end_stream = flags & END_STREAM;
+    }
+
+    return;
+}
+
+bool http2::Session::AppendHeaderBlock(std::uint32_t    stream_id,
+                                      std::string_view fragment)
+{
+    std::string & header_block = streams[stream_id].header_block;
+
+    // CONTINUATION frames would otherwise buffer without end
+    if (header_block.size() + fragment.size() > MAX_HEADER_LIST_SIZE)
+    {
+        ConnectionError(ENHANCE_YOUR_CALM);
+        return false;
+    }
+
+    header_block.append(fragment);
+
+    return true;
+}
+
+void http2::Session::FinishHeaderBlock(std::uint32_t stream_id,
+                                       bool          end_stream)
+{
+    Stream &            stream = streams[stream_id];
+    std::vector<Header> headers;
+
+    try
+    {
+        // Always decode to keep the HPACK state in sync with the client
+        headers = decoder.Decode(stream.header_block, MAX_HEADER_LIST_SIZE);
+    }
+    catch (const HeaderListSizeException &)
+    {
+        ConnectionError(ENHANCE_YOUR_CALM);
+        return;
+    }
+    catch (const HpackException &)
+    {
+        ConnectionError(COMPRESSION_ERROR);
+        return;
+    }
+
+    stream.header_block.clear();
+
+    // The handlers see the fields as HTTP/1.1 header lines, where these
+    // characters would start a line of their own (RFC 9113 §8.2.1)
+    for (const auto & [name, value] : headers)
+        if (name.find_first_of(std::string_view("\r\n\0", 3)) !=
+                std::string::npos ||
+            value.find_first_of(std::string_view("\r\n\0", 3)) !=
+                std::string::npos)
+        {
+            ResetStream(stream_id, PROTOCOL_ERROR);
+            return;
+        }
+
+    // Trailers are decoded but not passed to the handlers
+    if (stream.headers.empty())
+        stream.headers = std::move(headers);
+
+    if (going_away ||
+        streams.size() > static_cast<std::size_t>(MAX_CONCURRENT_STREAMS))
+    {
+        ResetStream(stream_id, REFUSED_STREAM);
+        return;
+    }
+
+    if (end_stream)
+    {
+        std::size_t taken = stream.request_body.size();
+
+        stream.request_complete = true;
+        Respond(stream_id);
+
+        buffered_body -= taken;
+        ReplenishWindow(taken);
+    }
+
+    return;
+}
+
+void http2::Session::ProcessData(std::uint8_t flags, std::uint32_t stream_id,
+                                 std::string_view payload)
+{
+    std::size_t flow_controlled = payload.size();
+
+    if (stream_id == 0 || ((flags & PADDED) && !removePadding(payload)))
+    {
+        ConnectionError(PROTOCOL_ERROR);
+        return;
+    }
+
+    receive_window -= flow_controlled;
+    if (receive_window < 0)
+    {
+        ConnectionError(FLOW_CONTROL_ERROR);
+        return;
+    }
+
+    auto it = streams.find(stream_id);
+
+    if (it == streams.end() || it->second.request_complete)
+    {
+        if (stream_id > last_stream_id)
+            ConnectionError(PROTOCOL_ERROR);
+        else
+        {
+            ReplenishWindow(flow_controlled);
+            ResetStream(stream_id, STREAM_CLOSED);
+        }
+        return;
+    }
+
+    // The padding is not kept, neither is its share of the window
+    ReplenishWindow(flow_controlled - payload.size());
+
+    // The connection window is used up and the stream is not complete, or
+    // past the limit altogether: answer before the whole body arrives
+    std::size_t buffered = buffered_body + payload.size();
+    if (buffered > max_request_body ||
+        (buffered == max_request_body && !(flags & END_STREAM)))
+    {
+        ReplenishWindow(payload.size());
+        WriteHeaders(stream_id, 413, {}, true);
+        ResetStream(stream_id, NO_ERROR);
+        return;
+    }
+
+    it->second.request_body.append(payload);
+    buffered_body = buffered;
+
+    if (flags & END_STREAM)
+    {
+        std::size_t taken = it->second.request_body.size();
+
+        it->second.request_complete = true;
+        Respond(stream_id);
+
+        // The handler is done with the body, let the client send more
+        buffered_body -= taken;
+        ReplenishWindow(taken);
+    }
+    else if (flow_controlled > 0)
+        WriteWindowUpdate(stream_id, flow_controlled);
+
+    return;
+}
+
+void http2::Session::ProcessSettings(std::uint8_t flags,
+                                     std::string_view payload,
+                                     bool             acknowledge)
+{
+    if (flags & ACK)
+    {
+        if (!payload.empty())
+            ConnectionError(FRAME_SIZE_ERROR);
+        return;
+    }
+
+    if (payload.size() % 6 != 0)
+    {
+        ConnectionError(FRAME_SIZE_ERROR);
+        return;
+    }
+
+    for (; !payload.empty(); payload.remove_prefix(6))
+    {
+        std::uint16_t id = static_cast<std::uint16_t>(
+            static_cast<unsigned char>(payload[0]) << 8 |
+            static_cast<unsigned char>(payload[1]));
+        std::uint32_t value = readUint32(payload.substr(2));
+
+        switch (id)
+        {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            encoder.SetMaxTableSize(value);
+            break;
+
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+            if (value > MAX_WINDOW_SIZE)
+            {
+                ConnectionError(FLOW_CONTROL_ERROR);
+                return;
+            }
+
+            // The change applies to every open stream
+            for (auto & [stream_id, stream] : streams)
+                stream.send_window += value - peer_initial_window;
+            peer_initial_window = value;
+            break;
+
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < 16384 || value > 0xffffff)
+            {
+                ConnectionError(PROTOCOL_ERROR);
+                return;
+            }
+            peer_max_frame_size = value;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (acknowledge)
+        WriteFrame(SETTINGS, ACK, 0, {});
+
+    return;
+}
+
+void http2::Session::ProcessWindowUpdate(std::uint32_t    stream_id,
+                                         std::string_view payload)
+{
+    if (payload.size() != 4)
+    {
+        ConnectionError(FRAME_SIZE_ERROR);
+        return;
+    }
+
+    std::int64_t increment = readUint32(payload) & 0x7fffffff;
+
+    if (stream_id == 0)
+    {
+        if (increment == 0 ||
+            connection_send_window + increment > MAX_WINDOW_SIZE)
+            ConnectionError(increment == 0 ? PROTOCOL_ERROR
+                                           : FLOW_CONTROL_ERROR);
+        else
+            connection_send_window += increment;
+        return;
+    }
+
+    auto it = streams.find(stream_id);
+
+    if (it == streams.end())
+        return;
+
+    if (increment == 0)
+        ResetStream(stream_id, PROTOCOL_ERROR);
+    else if (it->second.send_window + increment > MAX_WINDOW_SIZE)
+        ResetStream(stream_id, FLOW_CONTROL_ERROR);
+    else
+        it->second.send_window += increment;
+
+    return;
+}
+
+void http2::Session::Respond(std::uint32_t stream_id)
+{
+    Stream & stream = streams[stream_id];
+    Response response;
+
+    try
+    {
+        response = handler(stream_id, stream.headers, stream.request_body);
+    }
+    catch (const std::exception &)
+    {
+        response = Response{500, {}, {}};
+    }
+
+    std::string().swap(stream.request_body);
+
+    // The handler calls `Complete()' later
+    if (response.deferred)
+        return;
+
+    SendResponse(stream_id, std::move(response));
+
+    return;
+}
+
+void http2::Session::Complete(std::uint32_t stream_id, Response response)
+{
+    auto it = streams.find(stream_id);
+
+    // The client reset the stream or the connection failed meanwhile
+    if (closed || it == streams.end() || !it->second.request_complete ||
+        it->second.responded)
+    {
+        if (response.body_file >= 0)
+            close(response.body_file);
+        return;
+    }
+
+    SendResponse(stream_id, std::move(response));
+
+    return;
+}
+
+void http2::Session::SendResponse(std::uint32_t stream_id, Response response)
+{
+    Stream & stream = streams[stream_id];
+
+    // The stream owns the body file from here on
+    stream.pending        = std::move(response.body);
+    stream.body_file      = response.body_file;
+    stream.body_file_size = response.body_file_size;
+
+    bool end_stream = stream.PendingSize() == 0;
+
+    WriteHeaders(stream_id, response.status, std::move(response.headers),
+                 end_stream);
+
+    if (end_stream)
+    {
+        streams.erase(stream_id);
+        return;
+    }
+
+    stream.responded = true;
+
+    return;
+}
+
+void http2::Session::WriteHeaders(std::uint32_t stream_id, int status,
+                                  std::vector<Header> headers,
+                                  bool                end_stream)
+{
+    headers.emplace(headers.begin(), ":status", std::to_string(status));
+
+    std::string block;
+    encoder.Encode(headers, block);
+
+    // Split the block into HEADERS and CONTINUATION frames
+    std::string_view rest     = block;
+    std::string_view fragment = rest.substr(0, peer_max_frame_size);
+    rest.remove_prefix(fragment.size());
+
+    WriteFrame(HEADERS,
+               (end_stream ? END_STREAM : 0) | (rest.empty() ? END_HEADERS : 0),
+               stream_id, fragment);
+
+    while (!rest.empty())
+    {
+        fragment = rest.substr(0, peer_max_frame_size);
+        rest.remove_prefix(fragment.size());
+        WriteFrame(CONTINUATION, rest.empty() ? END_HEADERS : 0, stream_id,
+                   fragment);
+    }
+
+    return;
+}
+
+void http2::Session::ScheduleData(std::size_t limit)
+{
+    bool progressed = true;
+
+    while (progressed && connection_send_window > 0 && output.size() < limit)
+    {
+        progressed = false;
+
+        // One frame per stream per round, starting after the stream served
+        // last so the earlier streams do not always go first
+        auto it = streams.lower_bound(next_data_stream);
+
+        for (std::size_t visited = streams.size();
+             visited > 0 && !streams.empty() && connection_send_window > 0 &&
+             output.size() < limit;
+             visited--)
+        {
+            if (it == streams.end())
+                it = streams.begin();
+
+            std::uint32_t stream_id = it->first;
+            Stream &      stream    = it->second;
+            ++it; /* Before the stream may be erased */
+
+            if (!stream.responded || stream.send_window <= 0)
+                continue;
+
+            std::size_t chunk = std::min<std::int64_t>(
+                {static_cast<std::int64_t>(stream.PendingSize()),
+                 static_cast<std::int64_t>(peer_max_frame_size),
+                 connection_send_window, stream.send_window});
+            bool last = chunk == stream.PendingSize();
+
+            next_data_stream = stream_id + 1;
+
+            if (!WriteData(stream_id, stream, chunk, last))
+            {
+                ResetStream(stream_id, INTERNAL_ERROR);
+                continue;
+            }
+
+            stream.pending_offset += chunk;
+            stream.send_window -= chunk;
+            connection_send_window -= chunk;
+            progressed = true;
+
+            if (last)
+                streams.erase(stream_id);
+        }
+    }
+
+    return;
+}
+
+bool http2::Session::WriteData(std::uint32_t stream_id, Stream & stream,
+                               std::size_t length, bool end_stream)
+{
+    if (stream.body_file < 0)
+    {
+        WriteFrame(DATA, end_stream ? END_STREAM : 0, stream_id,
+                   std::string_view(stream.pending)
+                       .substr(stream.pending_offset, length));
+        return true;
+    }
+
+    // A file body is read one frame at a time
+    std::string chunk(length, '\0');
+    std::size_t loaded = 0;
+
+    while (loaded < length)
+    {
+        ssize_t n = pread(stream.body_file, chunk.data() + loaded,
+                          length - loaded, stream.pending_offset + loaded);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        loaded += n;
+    }
+
+    WriteFrame(DATA, end_stream ? END_STREAM : 0, stream_id, chunk);
+
+    return true;
+}
@@ -0,0 +1,302 @@
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include "hpack.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+BEGIN_HTTP2_NAMESPACE
+
+/**
+ *@brief The server side of one HTTP/2 connection (RFC 9113)
+ *
+ * The session is a pure state machine: the caller feeds it the bytes read
+ * from the socket and writes out whatever `TakeOutput()' returns.
+ * Requests are dispatched to the handler as soon as their stream is
+ * complete, and response bodies are interleaved frame by frame across
+ * streams within the peer's flow control windows.
+ *
+ * Request bodies are buffered until the handler takes them, so the
+ * connection window only grows back as bodies are handed over, and a
+ * stream whose body would pass the buffering limit is answered with 413.
+ */
+class Session
+{
+public:
+    struct Response
+    {
+        int                 status = 200;
+        std::vector<Header> headers;
+        std::string         body;
+        int                 body_file      = -1; /* Sent instead of `body' */
+        std::size_t         body_file_size = 0;
+        bool                deferred = false; /* Sent later by `Complete()' */
+    };
+
+    /**
+     * Serve one request given its stream, its header list (pseudo-headers
+     * first) and its body
+     */
+    using Handler = std::function<Response(
+        std::uint32_t, const std::vector<Header> &, const std::string &)>;
+
+    static constexpr std::string_view CLIENT_PREFACE =
+        "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+private:
+    enum FrameType : std::uint8_t
+    {
+        DATA          = 0x0,
+        HEADERS       = 0x1,
+        PRIORITY      = 0x2,
+        RST_STREAM    = 0x3,
+        SETTINGS      = 0x4,
+        PUSH_PROMISE  = 0x5,
+        PING          = 0x6,
+        GOAWAY        = 0x7,
+        WINDOW_UPDATE = 0x8,
+        CONTINUATION  = 0x9,
+    };
+
+    enum FrameFlag : std::uint8_t
+    {
+        END_STREAM    = 0x1,
+        ACK           = 0x1,
+        END_HEADERS   = 0x4,
+        PADDED        = 0x8,
+        PRIORITY_FLAG = 0x20,
+    };
+
+public:
+    enum ErrorCode : std::uint32_t
+    {
+        NO_ERROR           = 0x0,
+        PROTOCOL_ERROR     = 0x1,
+        INTERNAL_ERROR     = 0x2,
+        FLOW_CONTROL_ERROR = 0x3,
+        STREAM_CLOSED      = 0x5,
+        FRAME_SIZE_ERROR   = 0x6,
+        REFUSED_STREAM     = 0x7,
+        COMPRESSION_ERROR  = 0x9,
+        ENHANCE_YOUR_CALM  = 0xb,
+    };
+
+private:
+    enum { MAX_CONCURRENT_STREAMS = 100 };
+
+    static constexpr std::int64_t MAX_WINDOW_SIZE     = 0x7fffffff;
+    static constexpr std::int64_t DEFAULT_WINDOW_SIZE = 65535;
+    static constexpr std::int64_t LOCAL_WINDOW_SIZE   = 1 << 20;
+    static constexpr std::size_t  LOCAL_MAX_FRAME     = 16384;
+
+    // Decoded size of a header list as RFC 9113 §6.5.2 counts it; the
+    // encoded block buffered until END_HEADERS is held to the same bound
+    static constexpr std::size_t MAX_HEADER_LIST_SIZE = 64 * 1024;
+
+    struct Stream
+    {
+        std::string         header_block;
+        std::vector<Header> headers;
+        std::string         request_body;
+        bool                request_complete = false;
+
+        std::string  pending; /* Response body not yet framed */
+        int          body_file      = -1; /* Or the file it is read from */
+        std::size_t  body_file_size = 0;
+        std::size_t  pending_offset = 0;
+        bool         responded      = false;
+        std::int64_t send_window    = DEFAULT_WINDOW_SIZE;
+
+        Stream() = default;
+        Stream(const Stream &)             = delete;
+        Stream & operator=(const Stream &) = delete;
+        ~Stream();
+
+        /**
+         *@brief Get the number of response body bytes not yet framed
+         */
+        std::size_t PendingSize() const
+        {
+            return (body_file >= 0 ? body_file_size : pending.size()) -
+                   pending_offset;
+        }
+    };
+
+    Handler      handler;
+    HpackDecoder decoder;
+    HpackEncoder encoder;
+
+    std::string input;
+    std::string output;
+    bool        preface_received = false;
+
+    std::map<std::uint32_t, Stream> streams;
+    std::uint32_t                   last_stream_id   = 0;
+    std::uint32_t                   next_data_stream = 0; /* Round-robin */
+    std::uint32_t continuation_stream = 0; /* Stream awaiting CONTINUATION */
+    bool          continuation_end_stream = false;
+
+    std::size_t  max_request_body;
+    std::size_t  buffered_body = 0; /* Request bytes not taken yet */
+    std::int64_t receive_window = DEFAULT_WINDOW_SIZE;
+
+    std::int64_t connection_send_window = DEFAULT_WINDOW_SIZE;
+    std::int64_t peer_initial_window    = DEFAULT_WINDOW_SIZE;
+    std::size_t  peer_max_frame_size    = 16384;
+
+    bool going_away = false; /* GOAWAY sent, finishing open streams */
+    bool closed     = false;
+
+    void WriteFrame(std::uint8_t type, std::uint8_t flags,
+                    std::uint32_t stream_id, std::string_view payload);
+    void WriteSettings();
+    void WriteWindowUpdate(std::uint32_t stream_id, std::uint32_t increment);
+    void ResetStream(std::uint32_t stream_id, ErrorCode code);
+
+    /**
+     *@brief Forget a stream, giving back the window its buffered request
+     * body holds
+     *
+     * @return the stream after it
+     */
+    std::map<std::uint32_t, Stream>::iterator
+    EraseStream(std::map<std::uint32_t, Stream>::iterator it);
+
+    /**
+     *@brief Give `length' bytes back to the connection receive window
+     */
+    void ReplenishWindow(std::size_t length);
+
+    /**
+     *@brief Send GOAWAY and stop processing the connection
+     */
+    void ConnectionError(ErrorCode code);
+
+    void ProcessFrame(std::uint8_t type, std::uint8_t flags,
+                      std::uint32_t stream_id, std::string_view payload);
+    void ProcessHeaders(std::uint8_t flags, std::uint32_t stream_id,
+                        std::string_view payload);
+    void ProcessData(std::uint8_t flags, std::uint32_t stream_id,
+                     std::string_view payload);
+    void ProcessSettings(std::uint8_t flags, std::string_view payload,
+                         bool acknowledge = true);
+    void ProcessWindowUpdate(std::uint32_t stream_id, std::string_view payload);
+
+    /**
+     *@brief Buffer a fragment of the header block of a stream
+     *
+     * @return false the block grew past `MAX_HEADER_LIST_SIZE', the
+     * connection is closed
+     */
+    bool AppendHeaderBlock(std::uint32_t stream_id, std::string_view fragment);
+
+    /**
+     *@brief Decode the header block of a stream once END_HEADERS arrives
+     */
+    void FinishHeaderBlock(std::uint32_t stream_id, bool end_stream);
+
+    /**
+     *@brief Run the handler for a complete request and queue the response,
+     * unless the handler deferred it
+     */
+    void Respond(std::uint32_t stream_id);
+
+    /**
+     *@brief Queue the response of a stream, its body framed as room allows
+     */
+    void SendResponse(std::uint32_t stream_id, Response response);
+
+    /**
+     *@brief Write the HEADERS and CONTINUATION frames of a response
+     */
+    void WriteHeaders(std::uint32_t stream_id, int status,
+                      std::vector<Header> headers, bool end_stream);
+
+    /**
+     *@brief Frame pending response bodies, one frame per stream per round,
+     * as far as the flow control windows allow and until the output holds
+     * `limit' bytes
+     */
+    void ScheduleData(std::size_t limit);
+
+    /**
+     *@brief Write one DATA frame of the pending body of a stream
+     *
+     * @return false the body file could not be read
+     */
+    bool WriteData(std::uint32_t stream_id, Stream & stream,
+                   std::size_t length, bool end_stream);
+
+public:
+    /**
+     * @param h the request handler
+     * @param max_body the most request body bytes buffered at once
+     */
+    Session(Handler h, std::size_t max_body)
+        : handler(std::move(h)), max_request_body(max_body)
+    {
+    }
+
+    /**
+     *@brief Start a connection opened with the client preface
+     */
+    void Start();
+
+    /**
+     *@brief Start a connection upgraded from HTTP/1.1; the upgrade request
+     * becomes stream 1
+     *
+     * @param settings the base64url `HTTP2-Settings' header
+     * @param headers the request headers, pseudo-headers first
+     * @param body the request body
+     */
+    void StartUpgraded(std::string_view settings,
+                       const std::vector<Header> & headers,
+                       const std::string & body);
+
+    /**
+     *@brief Process bytes read from the connection
+     */
+    void Feed(std::string_view data);
+
+    /**
+     *@brief Send the response the handler deferred for a stream
+     *
+     * Dropped, closing its body file, if the stream is gone by now.
+     */
+    void Complete(std::uint32_t stream_id, Response response);
+
+    /**
+     *@brief Gracefully shut down: refuse new streams, finish open ones
+     */
+    void GoAway();
+
+    /**
+     *@brief Take the bytes to write to the connection
+     *
+     * Response bodies are framed only as far as the output stays below
+     * `limit' bytes, the rest waits for the next call.
+     *
+     * @param limit the room left in the connection's output
+     */
+    std::string TakeOutput(std::size_t limit);
+
+    /**
+     *@brief Whether response body bytes are waiting for output room rather
+     * than for the peer's flow control windows
+     */
+    bool HasPendingData() const;
+
+    /**
+     *@brief Whether the connection should be closed once output is written
+     */
+    bool IsClosed() const { return closed || (going_away && streams.empty()); }
+};
+
+END_HTTP2_NAMESPACE
+
+#endif // !_SESSION_H_
@@ -1,26 +1,112 @@
 #include "server/server.h"
-#include <filesystem>
+#include <chrono>
+#include <exception>
+#include <iostream>
 #include <string>
-#include <thread>
 
-namespace fs = std::filesystem;
+/**
+ *@brief Parse a drain timeout in seconds
+ *
+ * @return false the value is not a non-negative integer, `seconds' is kept
+ */
+static bool parseDrainTimeout(const std::string & value, int & seconds)
+{
+    try
+    {
+        std::size_t end;
+        int         parsed = std::stoi(value, &end);
+
+        if (end != value.size() || parsed < 0)
+            return false;
+
+        seconds = parsed;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+
+    return true;
+}
 
 int main(int argc, char ** argv)
 {
-    if (argc == 3 && std::string(argv[1]) == "--directory")
-        fs::current_path(argv[2]);
+    std::string upgrade_socket;     /* Unix socket for hot upgrades */
+    int         drain_timeout = 10; /* Seconds to finish in-flight requests */
 
     server::Server http_server(4221);
 
-    http_server.InitializeSocket();
-    http_server.Listen();
-
-    while (true)
+    for (int i = 1; i + 1 < argc; i += 2)
     {
-        int client_fd = http_server.AcceptClient();
+        std::string option(argv[i]);
+
+        if (option == "--directory")
+        {
+            if (!http_server.SetRootDirectory(argv[i + 1]))
+            {
+                std::cerr << "Cannot open directory: " << argv[i + 1] << '\n';
+                return 1;
+            }
+        }
+        else if (option == "--upgrade-socket")
+            upgrade_socket = argv[i + 1];
+        else if (option == "--drain-timeout")
+        {
+            if (!parseDrainTimeout(argv[i + 1], drain_timeout))
+                std::cerr << "Ignoring invalid drain timeout: " << argv[i + 1]
+                          << '\n';
+        }
+        else if (option == "--codec")
+        {
+            if (!http_server.ConfigureCompression(argv[i + 1]))
+            {
+                std::cerr << "Invalid codec: " << argv[i + 1] << '\n';
+                return 1;
+            }
+        }
+        else if (option.starts_with("--tls-"))
+        {
+            if (!http_server.ConfigureTls(option, argv[i + 1]))
+                std::cerr << "Ignoring invalid TLS option: " << option << '\n';
+        }
+        else if (option == "--proxy")
+        {
+            if (!http_server.ConfigureProxy(argv[i + 1]))
+                std::cerr << "Ignoring invalid proxy route: " << argv[i + 1]
+                          << '\n';
+        }
+        else if (option.starts_with("--trace-"))
+        {
+            if (!http_server.ConfigureTracing(option, argv[i + 1]))
+                std::cerr << "Ignoring invalid trace option: " << option
+                          << '\n';
+        }
+        else if (option == "--worker-threads")
+        {
+            if (!http_server.ConfigureWorkers(option, argv[i + 1]))
+                std::cerr << "Ignoring invalid worker thread count: "
+                          << argv[i + 1] << '\n';
+        }
+        else if (!http_server.ConfigureAdmission(option, argv[i + 1]))
+            std::cerr << "Ignoring unknown option or invalid value: " << option
+                      << ' ' << argv[i + 1] << '\n';
+    }
+
+    http_server.InstallSignalHandlers();
 
-        std::thread([&]() { http_server.HandleClient(client_fd); }).detach();
+    // Take over the port from a running server, or bind it ourselves
+    if (upgrade_socket.empty() || !http_server.InheritSocket(upgrade_socket))
+    {
+        http_server.InitializeSocket();
+        http_server.Listen();
     }
 
+    http_server.ListenTls();
+
+    if (!upgrade_socket.empty())
+        http_server.ListenForUpgrade(upgrade_socket);
+
+    http_server.Run(std::chrono::seconds(drain_timeout));
+
     return 0;
 }
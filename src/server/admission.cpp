@@ -0,0 +1,172 @@
+#include "admission.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <stdexcept>
+
+// Prune at most this often, and only once there are many buckets
+constexpr auto        PRUNE_INTERVAL    = std::chrono::seconds(10);
+constexpr std::size_t PRUNE_MIN_BUCKETS = 1024;
+
+/**
+ *@brief Parse all of `value' as an integer within [min, max]
+ */
+static bool parseInteger(const std::string & value, long long min,
+                         long long max, long long & result)
+{
+    try
+    {
+        std::size_t end;
+        long long   parsed = std::stoll(value, &end);
+
+        if (end != value.size() || parsed < min || parsed > max)
+            return false;
+
+        result = parsed;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ *@brief Parse all of `value' as a finite number above zero
+ */
+static bool parsePositive(const std::string & value, double & result)
+{
+    try
+    {
+        std::size_t end;
+        double      parsed = std::stod(value, &end);
+
+        if (end != value.size() || !std::isfinite(parsed) || parsed <= 0)
+            return false;
+
+        result = parsed;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool admission::TokenBucket::Take(double rate, double burst,
+                                  Clock::time_point now)
+{
+    std::chrono::duration<double> elapsed = now - last_refill;
+
+    tokens      = std::min(burst, tokens + elapsed.count() * rate);
+    last_refill = now;
+
+    if (tokens < 1)
+        return false;
+
+    tokens -= 1;
+
+    return true;
+}
+
+bool admission::TokenBucket::IsFull(double rate, double burst,
+                                    Clock::time_point now) const
+{
+    std::chrono::duration<double> elapsed = now - last_refill;
+
+    return tokens + elapsed.count() * rate >= burst;
+}
+
+void admission::AdmissionControl::ComposeOverloadResponse()
+{
+    overload_response = "HTTP/1.1 503 Service Unavailable\r\n"
+                        "Retry-After: " +
+                        std::to_string(settings.retry_after) +
+                        "\r\n"
+                        "Content-Length: 0\r\n"
+                        "Connection: close\r\n\r\n";
+
+    return;
+}
+
+bool admission::AdmissionControl::Configure(const std::string & option,
+                                            const std::string & value)
+{
+    long long count;
+
+    if (option == "--max-connections")
+    {
+        if (!parseInteger(value, 1, LLONG_MAX, count))
+            return false;
+        settings.max_connections = count;
+    }
+    else if (option == "--rate-limit")
+        return parsePositive(value, settings.rate);
+    else if (option == "--rate-burst")
+        return parsePositive(value, settings.burst);
+    else if (option == "--shed-queue-depth")
+    {
+        if (!parseInteger(value, 0, LLONG_MAX, count))
+            return false;
+        settings.shed_queue_depth = count;
+    }
+    else if (option == "--retry-after")
+    {
+        if (!parseInteger(value, 0, INT_MAX, count))
+            return false;
+        settings.retry_after = count;
+        ComposeOverloadResponse();
+    }
+    else
+        return false;
+
+    return true;
+}
+
+double admission::AdmissionControl::Burst() const
+{
+    // At least one token, or a rate below one request per second would
+    // refuse every request
+    return std::max(settings.burst > 0 ? settings.burst : settings.rate, 1.0);
+}
+
+bool admission::AdmissionControl::AdmitConnection(
+    std::size_t open_connections, std::size_t queue_depth) const
+{
+    if (open_connections >= settings.max_connections)
+        return false;
+
+    // A long accept queue means the loop cannot keep up, answer early
+    return !ShedsOnQueueDepth() || queue_depth <= settings.shed_queue_depth;
+}
+
+bool admission::AdmissionControl::AdmitRequest(std::uint32_t address)
+{
+    if (settings.rate <= 0)
+        return true;
+
+    Clock::time_point now   = Clock::now();
+    double            burst = Burst();
+
+    Prune(now);
+
+    return buckets.try_emplace(address, burst, now)
+        .first->second.Take(settings.rate, burst, now);
+}
+
+void admission::AdmissionControl::Prune(Clock::time_point now)
+{
+    if (buckets.size() < PRUNE_MIN_BUCKETS || now - last_prune < PRUNE_INTERVAL)
+        return;
+
+    double burst = Burst();
+
+    std::erase_if(buckets, [&](const auto & entry) {
+        return entry.second.IsFull(settings.rate, burst, now);
+    });
+    last_prune = now;
+
+    return;
+}
@@ -0,0 +1,129 @@
+#ifndef _ADMISSION_H_
+#define _ADMISSION_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#define BEGIN_ADMISSION_NAMESPACE \
+    namespace admission           \
+    {
+#define END_ADMISSION_NAMESPACE }
+
+BEGIN_ADMISSION_NAMESPACE
+
+using Clock = std::chrono::steady_clock;
+
+struct Settings
+{
+    std::size_t max_connections  = 10000; /* Open connections at once */
+    double      rate             = 0;     /* Requests/s per IP, 0 is off */
+    double      burst            = 0;     /* Bucket size, 0 is the rate */
+    std::size_t shed_queue_depth = 0;     /* Accept queue limit, 0 is off */
+    int         retry_after      = 1;     /* Seconds, sent with the 503 */
+};
+
+/**
+ *@brief A token bucket refilled at `rate' tokens per second up to `burst'
+ */
+class TokenBucket
+{
+private:
+    double            tokens;
+    Clock::time_point last_refill;
+
+public:
+    TokenBucket(double burst, Clock::time_point now)
+        : tokens(burst), last_refill(now)
+    {
+    }
+
+    /**
+     *@brief Take one token if there is one
+     */
+    bool Take(double rate, double burst, Clock::time_point now);
+
+    /**
+     *@brief Whether the bucket has been idle long enough to be full
+     */
+    bool IsFull(double rate, double burst, Clock::time_point now) const;
+};
+
+/**
+ *@brief Decide which connections and requests are served when the server
+ * is overloaded; the rest get a fast 503
+ */
+class AdmissionControl
+{
+private:
+    Settings settings;
+
+    // One bucket per IPv4 source address
+    std::unordered_map<std::uint32_t, TokenBucket> buckets;
+    Clock::time_point                              last_prune;
+
+    std::string overload_response; /* Precomposed 503 */
+
+    void ComposeOverloadResponse();
+
+    /**
+     *@brief Get the bucket size: the configured burst, else the rate, and
+     * never below one token
+     */
+    double Burst() const;
+
+    /**
+     *@brief Drop the buckets that refilled completely, they carry no state
+     */
+    void Prune(Clock::time_point now);
+
+public:
+    AdmissionControl() { ComposeOverloadResponse(); }
+
+    /**
+     *@brief Set an admission option
+     *
+     * @param option the command line option, e.g. `--rate-limit'
+     * @param value its value
+     * @return true the option belongs to admission control and its value
+     * is valid
+     */
+    bool Configure(const std::string & option, const std::string & value);
+
+    /**
+     *@brief Whether a new connection may be served
+     *
+     * @param open_connections connections currently open
+     * @param queue_depth connections waiting in the accept queue
+     */
+    bool AdmitConnection(std::size_t open_connections,
+                         std::size_t queue_depth) const;
+
+    /**
+     *@brief Whether a request from `address' is within its rate limit
+     *
+     * @param address the IPv4 source address, in network byte order
+     */
+    bool AdmitRequest(std::uint32_t address);
+
+    /**
+     *@brief Whether the accept queue depth has to be measured
+     */
+    bool ShedsOnQueueDepth() const { return settings.shed_queue_depth != 0; }
+
+    int GetRetryAfter() const { return settings.retry_after; }
+
+    /**
+     *@brief The complete `503 Service Unavailable' response, built once
+     */
+    const std::string & GetOverloadResponse() const
+    {
+        return overload_response;
+    }
+};
+
+END_ADMISSION_NAMESPACE
+
+#endif // !_ADMISSION_H_
@@ -0,0 +1,307 @@
+#include "compression.h"
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <zlib.h>
+
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static const char * CODEC_NAMES[compression::CODEC_COUNT] = {
+    "zstd",
+    "br",
+    "gzip",
+    "identity",
+};
+
+static std::string gzipCompress(const std::string & data, int level)
+{
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) !=
+        Z_OK)
+        throw std::runtime_error("deflateInit2 failed while compressing.");
+
+    zs.next_in  = (Bytef *) data.data();
+    zs.avail_in = data.size();
+
+    int         ret;
+    char        outbuffer[32768];
+    std::string outstring;
+
+    do
+    {
+        zs.next_out  = reinterpret_cast<Bytef *>(outbuffer);
+        zs.avail_out = sizeof(outbuffer);
+        ret          = deflate(&zs, Z_FINISH);
+
+        if (outstring.size() < zs.total_out)
+            outstring.append(outbuffer, zs.total_out - outstring.size());
+
+    } while (ret == Z_OK);
+
+    deflateEnd(&zs);
+
+    if (ret != Z_STREAM_END)
+        throw std::runtime_error("Exception during zlib compression: (" +
+                                 std::to_string(ret) + ") " + zs.msg);
+
+    return outstring;
+}
+
+#ifdef HAVE_BROTLI
+static std::string brotliCompress(const std::string & data, int level)
+{
+    std::string out(BrotliEncoderMaxCompressedSize(data.size()), '\0');
+    std::size_t out_size = out.size();
+
+    if (!BrotliEncoderCompress(level, BROTLI_DEFAULT_WINDOW,
+                               BROTLI_DEFAULT_MODE, data.size(),
+                               (const uint8_t *) data.data(), &out_size,
+                               (uint8_t *) out.data()))
+        throw std::runtime_error("Exception during brotli compression");
+
+    out.resize(out_size);
+
+    return out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static std::string zstdCompress(const std::string & data, int level)
+{
+    // One context per thread avoids reallocating it for every response
+    thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx *)> context(
+        ZSTD_createCCtx(), ZSTD_freeCCtx);
+
+    std::string out(ZSTD_compressBound(data.size()), '\0');
+    std::size_t out_size = ZSTD_compressCCtx(
+        context.get(), out.data(), out.size(), data.data(), data.size(), level);
+
+    if (ZSTD_isError(out_size))
+        throw std::runtime_error(
+            std::string("Exception during zstd compression: ") +
+            ZSTD_getErrorName(out_size));
+
+    out.resize(out_size);
+
+    return out;
+}
+#endif
+
+/**
+ *@brief Parse a whole string as a number
+ *
+ * @return false the string is not a number of type `T'
+ */
+template <typename T> static bool parseNumber(std::string_view text, T & value)
+{
+    auto [end, error] =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+
+    return error == std::errc() && end == text.data() + text.size();
+}
+
+/**
+ *@brief Whether a compression level is one the codec accepts
+ */
+static bool validLevel(compression::Codec codec, int level)
+{
+    switch (codec)
+    {
+    case compression::Codec::GZIP:
+        return level >= Z_NO_COMPRESSION && level <= Z_BEST_COMPRESSION;
+#ifdef HAVE_BROTLI
+    case compression::Codec::BROTLI:
+        return level >= BROTLI_MIN_QUALITY && level <= BROTLI_MAX_QUALITY;
+#endif
+#ifdef HAVE_ZSTD
+    case compression::Codec::ZSTD:
+        return level >= ZSTD_minCLevel() && level <= ZSTD_maxCLevel();
+#endif
+    default:
+        return false;
+    }
+}
+
+compression::Compressor::Compressor()
+{
+    settings[static_cast<int>(Codec::ZSTD)].level   = 3;
+    settings[static_cast<int>(Codec::BROTLI)].level = 5;
+    settings[static_cast<int>(Codec::GZIP)].level   = Z_BEST_COMPRESSION;
+
+    for (std::size_t i = 0; i < CODEC_COUNT; i++)
+        settings[i].enabled = Available(static_cast<Codec>(i));
+}
+
+bool compression::Compressor::Configure(const std::string & spec)
+{
+    std::size_t first_colon = spec.find(':');
+    std::string name        = spec.substr(0, first_colon);
+    std::string rest        = first_colon == std::string::npos
+                                  ? ""
+                                  : spec.substr(first_colon + 1);
+
+    for (std::size_t i = 0; i < CODEC_COUNT; i++)
+    {
+        Codec codec = static_cast<Codec>(i);
+
+        if (name != CODEC_NAMES[i] || codec == Codec::IDENTITY)
+            continue;
+
+        if (rest == "off")
+        {
+            settings[i].enabled = false;
+            return true;
+        }
+
+        if (!Available(codec))
+            return false;
+
+        std::size_t second_colon = rest.find(':');
+        int         level;
+        std::size_t min_size = settings[i].min_size;
+
+        if (!parseNumber(std::string_view(rest).substr(0, second_colon),
+                         level) ||
+            !validLevel(codec, level) ||
+            (second_colon != std::string::npos &&
+             !parseNumber(std::string_view(rest).substr(second_colon + 1),
+                          min_size)))
+            return false;
+
+        settings[i].level    = level;
+        settings[i].min_size = min_size;
+        settings[i].enabled  = true;
+
+        return true;
+    }
+
+    return false;
+}
+
+std::optional<compression::Codec> compression::Compressor::Negotiate(
+    const std::vector<message::CompressionOption> & options,
+    std::size_t                                     body_size) const
+{
+    double wildcard = -1; /* Weight of `*', negative if absent */
+    double identity = -1; /* Weight of `identity', negative if absent */
+
+    for (const auto & option : options)
+        if (option.coding == "*")
+            wildcard = option.quality;
+        else if (option.coding == "identity")
+            identity = option.quality;
+
+    bool identity_refused = identity < 0 ? wildcard == 0 : identity == 0;
+
+    // A codec has to outweigh identity, whose weight is only taken from an
+    // explicit entry: `*' alone would outweigh or tie with every coding
+    Codec  best         = Codec::IDENTITY;
+    double best_quality = identity < 0 ? 0 : identity;
+
+    for (std::size_t i = 0; i < CODEC_COUNT; i++)
+    {
+        Codec codec = static_cast<Codec>(i);
+
+        if (codec == Codec::IDENTITY || !settings[i].enabled ||
+            (body_size < settings[i].min_size && !identity_refused))
+            continue;
+
+        double quality = wildcard < 0 ? 0 : wildcard;
+
+        for (const auto & option : options)
+            if (option.coding == CODEC_NAMES[i] ||
+                (codec == Codec::GZIP && option.coding == "x-gzip"))
+                quality = option.quality;
+
+        if (quality > best_quality)
+        {
+            best         = codec;
+            best_quality = quality;
+        }
+    }
+
+    if (best == Codec::IDENTITY && identity_refused)
+        return std::nullopt;
+
+    return best;
+}
+
+std::string compression::Compressor::Compress(Codec               codec,
+                                              const std::string & data) const
+{
+    int level = settings[static_cast<int>(codec)].level;
+
+    switch (codec)
+    {
+    case Codec::GZIP:
+        return gzipCompress(data, level);
+#ifdef HAVE_BROTLI
+    case Codec::BROTLI:
+        return brotliCompress(data, level);
+#endif
+#ifdef HAVE_ZSTD
+    case Codec::ZSTD:
+        return zstdCompress(data, level);
+#endif
+    default:
+        return data;
+    }
+}
+
+bool compression::Compressor::Apply(Codec              codec,
+                                    message::Message & message) const
+{
+    auto & response = message.GetResponsePointer();
+
+    response->LoadBodyFile();
+
+    try
+    {
+        response->SetBody(Compress(codec, response->GetBody()));
+    }
+    catch (const std::exception & e)
+    {
+        std::cerr << e.what() << ", sending the body uncompressed\n";
+        return false;
+    }
+
+    response->SetHeaderLine("Content-Encoding", Name(codec));
+
+    return true;
+}
+
+const char * compression::Compressor::Name(Codec codec)
+{
+    return CODEC_NAMES[static_cast<int>(codec)];
+}
+
+bool compression::Compressor::Available(Codec codec)
+{
+    switch (codec)
+    {
+    case Codec::BROTLI:
+#ifdef HAVE_BROTLI
+        return true;
+#else
+        return false;
+#endif
+    case Codec::ZSTD:
+#ifdef HAVE_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return true;
+    }
+}
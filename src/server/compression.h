@@ -0,0 +1,112 @@
+#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+
+#include "../http/message.h"
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+#define BEGIN_COMPRESSION_NAMESPACE \
+    namespace compression           \
+    {
+#define END_COMPRESSION_NAMESPACE }
+
+BEGIN_COMPRESSION_NAMESPACE
+
+/**
+ * Content codings the server can produce, in order of preference when the
+ * client weighs several of them equally
+ */
+enum class Codec
+{
+    ZSTD,
+    BROTLI,
+    GZIP,
+    IDENTITY,
+};
+
+constexpr std::size_t CODEC_COUNT = 4;
+
+struct CodecSettings
+{
+    bool        enabled  = true;
+    int         level    = 0; /* Codec specific compression level */
+    std::size_t min_size = 0; /* Smaller bodies are sent uncompressed */
+};
+
+class Compressor
+{
+private:
+    std::array<CodecSettings, CODEC_COUNT> settings;
+
+public:
+    Compressor();
+
+    /**
+     *@brief Configure a codec from `name:level[:min-size]' or `name:off'
+     *
+     * Levels range over 0-9 for gzip, 0-11 for br and what the library
+     * reports for zstd.
+     *
+     * @param spec the codec specification, e.g. `zstd:3:512'
+     * @return true the specification is valid
+     */
+    bool Configure(const std::string & spec);
+
+    /**
+     *@brief Choose the codec for a response (RFC 9110 §12.5.3)
+     *
+     * The codec with the highest weight wins; ties go to the codec listed
+     * first in `Codec'. Codings not mentioned take the weight of `*', and
+     * identity is acceptable unless it is explicitly refused, by
+     * `identity;q=0' or by `*;q=0' without an `identity' entry. A codec
+     * must weigh more than an explicit `identity' entry, ties go to
+     * identity. Once identity is refused, a body below a codec's minimum
+     * size is compressed anyway.
+     *
+     * @param options the parsed `Accept-Encoding' header
+     * @param body_size the size of the uncompressed body
+     * @return std::optional<Codec> the codec to use, none if no coding
+     * is acceptable, the caller answers 406 then
+     */
+    std::optional<Codec>
+    Negotiate(const std::vector<message::CompressionOption> & options,
+              std::size_t                                     body_size) const;
+
+    /**
+     *@brief Compress data with a codec
+     *
+     * @param codec the codec chosen by `Negotiate()'
+     * @param data the data to compress
+     * @return std::string the compressed data
+     */
+    std::string Compress(Codec codec, const std::string & data) const;
+
+    /**
+     *@brief Compress the body of a response and set its `Content-Encoding'
+     *
+     * A body file is read into memory first. If the codec fails, the body
+     * is left uncompressed and without `Content-Encoding'.
+     *
+     * @param codec the codec chosen by `Negotiate()'
+     * @param message the message whose response is compressed
+     * @return false the codec failed
+     */
+    bool Apply(Codec codec, message::Message & message) const;
+
+    /**
+     *@brief Get the `Content-Encoding' token of a codec
+     */
+    static const char * Name(Codec codec);
+
+    /**
+     *@brief Whether the codec was compiled in
+     */
+    static bool Available(Codec codec);
+};
+
+END_COMPRESSION_NAMESPACE
+
+#endif // !_COMPRESSION_H_
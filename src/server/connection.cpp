@@ -0,0 +1,210 @@
+#include "connection.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Upper bound of a single `sendfile' call so one response cannot hog a turn
+constexpr std::size_t SENDFILE_CHUNK = 1 << 20;
+
+// Buffers gathered into one `writev' call
+constexpr int MAX_IOVECS = 64;
+
+// Plaintext of one TLS record
+constexpr std::size_t TLS_RECORD_LENGTH = 16384;
+
+server::OutputQueue::~OutputQueue()
+{
+    for (const Chunk & chunk : chunks)
+        if (chunk.file_fd >= 0)
+            close(chunk.file_fd);
+}
+
+void server::OutputQueue::Push(std::string buffer)
+{
+    if (buffer.empty())
+        return;
+
+    Chunk chunk;
+    chunk.length = buffer.size();
+    chunk.buffer = std::move(buffer);
+
+    queued_bytes += chunk.length;
+    chunks.push_back(std::move(chunk));
+
+    return;
+}
+
+void server::OutputQueue::PushFile(int file_fd, off_t offset,
+                                   std::size_t length)
+{
+    if (length == 0)
+    {
+        close(file_fd);
+        return;
+    }
+
+    Chunk chunk;
+    chunk.file_fd = file_fd;
+    chunk.offset  = offset;
+    chunk.length  = length;
+
+    queued_bytes += length;
+    chunks.push_back(std::move(chunk));
+
+    return;
+}
+
+server::OutputQueue::FlushResult
+server::OutputQueue::Flush(int socket_fd, tls::Session * tls)
+{
+    // Without kTLS every byte is encrypted by OpenSSL
+    bool user_space_tls = tls && !tls->KernelSend();
+
+    while (!chunks.empty())
+    {
+        Chunk & front = chunks.front();
+        ssize_t written;
+
+        if (front.file_fd >= 0)
+            written = user_space_tls
+                          ? tls->WriteFile(front.file_fd, &front.offset,
+                                           front.length)
+                          : sendfile(socket_fd, front.file_fd, &front.offset,
+                                     std::min(front.length, SENDFILE_CHUNK));
+        else if (user_space_tls)
+        {
+            // Coalesce small buffers into one record
+            char        record[TLS_RECORD_LENGTH];
+            std::size_t length = 0;
+
+            for (auto it = chunks.begin(); it != chunks.end() &&
+                                           it->file_fd < 0 &&
+                                           length < sizeof(record);
+                 ++it)
+            {
+                std::size_t taken =
+                    std::min(it->length, sizeof(record) - length);
+                std::memcpy(record + length,
+                            it->buffer.data() +
+                                (it->buffer.size() - it->length),
+                            taken);
+                length += taken;
+            }
+
+            // A large buffer is written in place
+            written = length < front.length
+                          ? tls->Write(front.buffer.data() +
+                                           (front.buffer.size() - front.length),
+                                       front.length)
+                          : tls->Write(record, length);
+        }
+        else
+        {
+            // Gather the leading buffers, the first one may be half written
+            iovec iov[MAX_IOVECS];
+            int   count = 0;
+
+            for (auto it = chunks.begin();
+                 it != chunks.end() && it->file_fd < 0 && count < MAX_IOVECS;
+                 ++it, ++count)
+            {
+                iov[count].iov_base = it->buffer.data() +
+                                      (it->buffer.size() - it->length);
+                iov[count].iov_len = it->length;
+            }
+
+            written = writev(socket_fd, iov, count);
+        }
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return errno == EAGAIN || errno == EWOULDBLOCK
+                       ? FlushResult::BLOCKED
+                       : FlushResult::ERROR;
+        }
+
+        // The file shrank under us, the promised length cannot be sent
+        if (written == 0)
+            return FlushResult::ERROR;
+
+        queued_bytes -= written;
+        written_bytes += written;
+
+        if (front.file_fd >= 0)
+        {
+            front.length -= written;
+            if (front.length == 0)
+            {
+                close(front.file_fd);
+                chunks.pop_front();
+            }
+            continue;
+        }
+
+        // Retire the buffers covered by `writev'
+        std::size_t remaining = written;
+        while (remaining > 0)
+        {
+            Chunk &     chunk = chunks.front();
+            std::size_t taken = std::min(remaining, chunk.length);
+
+            chunk.length -= taken;
+            remaining -= taken;
+
+            if (chunk.length == 0)
+                chunks.pop_front();
+        }
+    }
+
+    return FlushResult::DONE;
+}
+
+bool server::Connection::BodyAwaiter::await_ready() const noexcept
+{
+    return connection.handler->body_left == 0 || !connection.input.empty() ||
+           connection.peer_closed;
+}
+
+void server::Connection::BodyAwaiter::await_suspend(
+    std::coroutine_handle<> awaiting) noexcept
+{
+    connection.handler->waiting_input = awaiting;
+}
+
+std::string server::Connection::BodyAwaiter::await_resume()
+{
+    std::uint64_t & body_left = connection.handler->body_left;
+    std::string &   input     = connection.input;
+
+    // Bytes past the body belong to the next request
+    if (input.size() <= body_left)
+    {
+        body_left -= input.size();
+        return std::exchange(input, std::string());
+    }
+
+    std::string chunk = input.substr(0, body_left);
+    input.erase(0, body_left);
+    body_left = 0;
+
+    return chunk;
+}
+
+bool server::Connection::WriteAwaiter::await_ready()
+{
+    connection.output.Push(std::move(data));
+
+    return connection.output.Size() < HIGH_WATER_MARK;
+}
+
+void server::Connection::WriteAwaiter::await_suspend(
+    std::coroutine_handle<> awaiting) noexcept
+{
+    connection.handler->waiting_output = awaiting;
+}
@@ -0,0 +1,196 @@
+#ifndef _CONNECTION_H_
+#define _CONNECTION_H_
+
+#include "../http2/session.h"
+#include "proxy.h"
+#include "task.h"
+#include "tls.h"
+#include "trace.h"
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+
+#define BEGIN_SERVER_NAMESPACE \
+    namespace server           \
+    {
+#define END_SERVER_NAMESPACE }
+
+BEGIN_SERVER_NAMESPACE
+
+// Stop reading a connection while this much output is queued
+enum { HIGH_WATER_MARK = 256 * 1024, LOW_WATER_MARK = 64 * 1024 };
+
+/**
+ *@brief Data waiting to be written to a socket: in-memory buffers and file
+ * ranges, flushed in order without blocking
+ */
+class OutputQueue
+{
+private:
+    struct Chunk
+    {
+        std::string buffer;
+        int         file_fd = -1; /* Owned, sent with `sendfile' */
+        off_t       offset  = 0;
+        std::size_t length  = 0; /* Bytes of the chunk not yet written */
+    };
+
+    std::deque<Chunk> chunks;
+    std::size_t       queued_bytes  = 0;
+    std::uint64_t     written_bytes = 0; /* Since the queue was created */
+
+public:
+    enum class FlushResult
+    {
+        DONE,    /* Everything was written */
+        BLOCKED, /* The socket is full, wait until it is writable */
+        ERROR,   /* The connection is broken */
+    };
+
+    OutputQueue() {}
+    OutputQueue(const OutputQueue &)             = delete;
+    OutputQueue & operator=(const OutputQueue &) = delete;
+    ~OutputQueue();
+
+    /**
+     *@brief Queue a buffer
+     */
+    void Push(std::string buffer);
+
+    /**
+     *@brief Queue a file range, taking ownership of the file descriptor
+     *
+     * @param file_fd the open file
+     * @param offset where the range starts
+     * @param length the length of the range
+     */
+    void PushFile(int file_fd, off_t offset, std::size_t length);
+
+    /**
+     *@brief Write as much as the socket accepts
+     *
+     * @param socket_fd the non-blocking socket
+     * @param tls the TLS session of the socket; unless the kernel encrypts
+     * for it, the data goes through the session
+     * @return FlushResult whether the queue was drained
+     */
+    FlushResult Flush(int socket_fd, tls::Session * tls = nullptr);
+
+    /**
+     *@brief The number of bytes waiting to be written
+     */
+    std::size_t Size() const { return queued_bytes; }
+
+    bool Empty() const { return chunks.empty(); }
+
+    /**
+     *@brief The number of bytes written so far; data pushed up to offset
+     * `Written() + Size()' is on the wire once `Written()' reaches it
+     */
+    std::uint64_t Written() const { return written_bytes; }
+};
+
+/**
+ *@brief A coroutine serving the current request of a connection
+ *
+ * The connection serves nothing else until it finishes. The event loop
+ * resumes it once what it awaits is there.
+ */
+struct Handler
+{
+    task::Task<>            task;
+    std::coroutine_handle<> waiting_input;  /* Suspended in `ReadBody()' */
+    std::coroutine_handle<> waiting_output; /* Suspended in `Write()' */
+    std::coroutine_handle<> waiting_job;    /* Suspended on a worker job */
+    bool                    job_done  = false;
+    std::uint64_t           id        = 0;  /* Tells handlers on an fd apart */
+    std::uint64_t           body_left = 0;  /* Request body not read yet */
+    bool                    close = false;  /* Close after the response */
+    trace::RequestTrace     request_trace;
+};
+
+/**
+ *@brief The state of one client connection owned by the event loop
+ */
+struct Connection
+{
+    int           fd;
+    std::uint64_t id = 0;  /* Tells connections on an fd apart */
+    std::uint32_t address; /* IPv4 source address, network byte order */
+    std::string   input;   /* Received data not parsed yet */
+    OutputQueue   output;
+
+    std::unique_ptr<http2::Session> http2; /* Set once HTTP/2 is spoken */
+    std::unique_ptr<proxy::Exchange> proxy; /* Request being forwarded */
+    std::unique_ptr<tls::Session>    tls;   /* Set on the TLS port */
+
+    trace::Ticks                    input_since = 0; /* Oldest unparsed byte */
+    std::deque<trace::RequestTrace> sending; /* Responses not written yet */
+
+    std::optional<Handler> handler; /* Set while a coroutine serves */
+
+    bool          reading_paused    = false; /* Output above high water */
+    bool          close_after_flush = false;
+    bool          peer_closed       = false;
+    bool          lingering = false; /* Output shut, input discarded */
+    std::uint32_t events    = 0;     /* Registered epoll events */
+
+    Connection(int client_fd, std::uint32_t client_address)
+        : fd(client_fd), address(client_address)
+    {
+    }
+
+    /**
+     *@brief Whether reads wait for the request in flight to take its input
+     *
+     * A forwarded request or a handler takes input at its own pace, so no
+     * more than a high-water mark of it is buffered meanwhile.
+     */
+    bool InputFull() const
+    {
+        return (proxy || handler) && input.size() >= HIGH_WATER_MARK;
+    }
+
+    struct BodyAwaiter
+    {
+        Connection & connection;
+
+        bool        await_ready() const noexcept;
+        void        await_suspend(std::coroutine_handle<> awaiting) noexcept;
+        std::string await_resume();
+    };
+
+    struct WriteAwaiter
+    {
+        Connection & connection;
+        std::string  data;
+
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> awaiting) noexcept;
+        void await_resume() noexcept {}
+    };
+
+    /**
+     *@brief Get the next part of the request body for the handler
+     *
+     * @return awaitable for the received data, empty once the body was read
+     * or the client closed
+     */
+    BodyAwaiter ReadBody() { return {*this}; }
+
+    /**
+     *@brief Queue response data for the handler, waiting while the output is
+     * above the high-water mark
+     */
+    WriteAwaiter Write(std::string data) { return {*this, std::move(data)}; }
+};
+
+END_SERVER_NAMESPACE
+
+#endif // !_CONNECTION_H_
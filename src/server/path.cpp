@@ -0,0 +1,89 @@
+#include "path.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char * path::BelowRoute(const std::string & path, std::string_view route)
+{
+    std::size_t start = path.find_first_not_of('/');
+
+    if (start != std::string::npos && !route.empty())
+        start = path.find_first_not_of('/', start + route.size());
+
+    return start == std::string::npos ? "." : path.c_str() + start;
+}
+
+int path::OpenBeneath(int root_fd, const char * path, int flags, mode_t mode)
+{
+    open_how how;
+    std::memset(&how, 0, sizeof(how));
+    how.flags   = flags | O_CLOEXEC;
+    how.mode    = (flags & O_CREAT) ? mode : 0;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+
+    int fd = syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+
+    if (fd >= 0 || errno != ENOSYS)
+        return fd;
+
+    return OpenByComponents(root_fd, path, flags, mode);
+}
+
+int path::OpenByComponents(int root_fd, const char * path, int flags,
+                           mode_t mode)
+{
+    if (path[0] == '/')
+    {
+        errno = EXDEV;
+        return -1;
+    }
+
+    std::string_view rest   = path;
+    std::string      name   = "."; /* The component opened last */
+    int              dir_fd = root_fd;
+
+    while (!rest.empty())
+    {
+        std::string_view segment = rest.substr(0, rest.find('/'));
+        rest.remove_prefix(std::min(segment.size() + 1, rest.size()));
+
+        if (segment.empty() || segment == ".")
+            continue;
+
+        if (segment == "..")
+        {
+            if (dir_fd != root_fd)
+                close(dir_fd);
+            errno = EXDEV;
+            return -1;
+        }
+
+        // Every component but the last must be a real directory
+        if (name != ".")
+        {
+            int next = openat(dir_fd, name.c_str(),
+                              O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (dir_fd != root_fd)
+                close(dir_fd);
+            if (next < 0)
+                return -1;
+            dir_fd = next;
+        }
+
+        name = segment;
+    }
+
+    int fd =
+        openat(dir_fd, name.c_str(), flags | O_CLOEXEC | O_NOFOLLOW, mode);
+    int saved = errno;
+
+    if (dir_fd != root_fd)
+        close(dir_fd);
+    errno = saved;
+
+    return fd;
+}
@@ -0,0 +1,52 @@
+#ifndef _PATH_H_
+#define _PATH_H_
+
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+#define BEGIN_PATH_NAMESPACE \
+    namespace path           \
+    {
+#define END_PATH_NAMESPACE }
+
+BEGIN_PATH_NAMESPACE
+
+/**
+ *@brief Get the part of the request path below the route, as a pointer into
+ * the path so that no copy is made
+ *
+ * @param path the original request path, e.g. `/files/a/b.txt'
+ * @param route the first path segment, e.g. `files'
+ * @return const char* the relative path, e.g. `a/b.txt', or `.' for the
+ * root itself
+ */
+const char * BelowRoute(const std::string & path, std::string_view route);
+
+/**
+ *@brief Open a path that must resolve inside `root_fd'
+ *
+ * `..' escapes, absolute paths and symbolic links are refused by the
+ * kernel, so the file endpoints cannot reach outside the root.
+ *
+ * @param root_fd the root directory, or `AT_FDCWD'
+ * @param path the path relative to the root
+ * @param flags the `open' flags
+ * @param mode the mode of a created file
+ * @return int the file descriptor, or -1 with `errno' set
+ */
+int OpenBeneath(int root_fd, const char * path, int flags, mode_t mode = 0);
+
+/**
+ *@brief The `OpenBeneath()' fallback for kernels without `openat2' (before
+ * 5.6): walk the path one component at a time
+ *
+ * Each directory is opened with `O_NOFOLLOW', so a symbolic link is refused
+ * at any depth, not only as the last component. `..' is refused outright.
+ */
+int OpenByComponents(int root_fd, const char * path, int flags,
+                     mode_t mode = 0);
+
+END_PATH_NAMESPACE
+
+#endif // !_PATH_H_
@@ -0,0 +1,711 @@
+#include "proxy.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <optional>
+#include <poll.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Upstream heads larger than this are refused
+constexpr std::size_t MAX_HEAD_LENGTH = 64 * 1024;
+
+// Chunk size and trailer lines longer than this are not framing we follow
+constexpr std::size_t MAX_LINE_LENGTH = 4096;
+
+// Idle keep-alive connections kept per upstream
+constexpr std::size_t MAX_IDLE_CONNECTIONS = 32;
+
+constexpr auto HEALTH_CHECK_INTERVAL = std::chrono::seconds(2);
+
+/**
+ *@brief Cut the first line out of `rest', dropping the line terminator
+ */
+static std::string_view takeLine(std::string_view & rest)
+{
+    std::size_t      line_end = rest.find('\n');
+    std::string_view line     = rest.substr(0, line_end);
+
+    rest.remove_prefix(line_end == std::string_view::npos ? rest.size()
+                                                          : line_end + 1);
+
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+
+    return line;
+}
+
+static std::string_view trim(std::string_view s)
+{
+    s.remove_prefix(std::min(s.find_first_not_of(" \t"), s.size()));
+    s.remove_suffix(s.size() - std::min(s.find_last_not_of(" \t") + 1,
+                                        s.size()));
+    return s;
+}
+
+static bool equalsIgnoreCase(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) ==
+                      std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+/**
+ *@brief Split a header line into its trimmed name and value
+ *
+ * @return false the line has no colon
+ */
+static bool splitHeader(std::string_view line, std::string_view & name,
+                        std::string_view & value)
+{
+    std::size_t colon = line.find(':');
+
+    if (colon == std::string_view::npos)
+        return false;
+
+    name  = trim(line.substr(0, colon));
+    value = trim(line.substr(colon + 1));
+
+    return true;
+}
+
+/**
+ *@brief Whether a comma separated header value lists `token'
+ */
+static bool listsToken(std::string_view value, std::string_view token)
+{
+    while (!value.empty())
+    {
+        std::size_t comma = value.find(',');
+
+        if (equalsIgnoreCase(trim(value.substr(0, comma)), token))
+            return true;
+
+        value.remove_prefix(comma == std::string_view::npos ? value.size()
+                                                            : comma + 1);
+    }
+
+    return false;
+}
+
+/**
+ *@brief Whether a header only applies to one connection (RFC 9110 §7.6.1),
+ * including the ones named by the `Connection' header
+ */
+static bool isHopByHop(std::string_view name, std::string_view connection)
+{
+    for (std::string_view hop_by_hop :
+         {"Connection", "Keep-Alive", "Proxy-Connection", "TE", "Upgrade"})
+        if (equalsIgnoreCase(name, hop_by_hop))
+            return true;
+
+    return listsToken(connection, name);
+}
+
+/**
+ *@brief Find the value of the `Connection' header in a head
+ */
+static std::string_view connectionHeader(std::string_view head)
+{
+    std::string_view name, value;
+
+    takeLine(head); /* Skip the start line */
+
+    while (!head.empty())
+        if (splitHeader(takeLine(head), name, value) &&
+            equalsIgnoreCase(name, "Connection"))
+            return value;
+
+    return {};
+}
+
+std::string proxy::RewriteRequestHead(std::string_view head,
+                                      std::uint32_t    client_address)
+{
+    std::string_view connection = connectionHeader(head);
+    std::string      rewritten;
+    std::string_view name, value;
+    char             address[INET_ADDRSTRLEN];
+    bool             forwarded = false;
+
+    inet_ntop(AF_INET, &client_address, address, sizeof(address));
+
+    rewritten.reserve(head.size() + 64);
+    rewritten.append(takeLine(head)).append("\r\n");
+
+    while (!head.empty())
+    {
+        std::string_view line = takeLine(head);
+
+        if (!splitHeader(line, name, value) || isHopByHop(name, connection))
+            continue;
+
+        rewritten.append(line);
+
+        // Extend the chain of an upstream proxy in front of us
+        if (equalsIgnoreCase(name, "X-Forwarded-For"))
+        {
+            rewritten.append(", ").append(address);
+            forwarded = true;
+        }
+
+        rewritten.append("\r\n");
+    }
+
+    if (!forwarded)
+        rewritten.append("X-Forwarded-For: ").append(address).append("\r\n");
+
+    rewritten.append("\r\n");
+
+    return rewritten;
+}
+
+bool proxy::ResponseReader::Feed(std::string_view data, std::string & relay)
+{
+    while (!data.empty() && state != State::DONE)
+    {
+        std::size_t taken;
+
+        switch (state)
+        {
+        case State::HEAD:
+        {
+            std::size_t received = head.size();
+            head.append(data);
+
+            std::size_t head_end =
+                head.find("\r\n\r\n", received < 3 ? 0 : received - 3);
+
+            if (head_end == std::string::npos)
+                return head.size() <= MAX_HEAD_LENGTH;
+
+            // The rest of `data' is body
+            data.remove_prefix(head_end + 4 - received);
+            head.resize(head_end + 4);
+
+            if (!FinishHead(relay))
+                return false;
+            continue;
+        }
+        case State::LENGTH:
+            taken = std::min<std::uint64_t>(left, data.size());
+            left -= taken;
+            if (left == 0)
+                state = State::DONE;
+            break;
+        case State::UNTIL_CLOSE:
+            taken = data.size();
+            break;
+        default:
+            taken = FeedChunked(data);
+            break;
+        }
+
+        relay.append(data.substr(0, taken));
+        data.remove_prefix(taken);
+    }
+
+    return true;
+}
+
+bool proxy::ResponseReader::FinishHead(std::string & relay)
+{
+    std::string_view rest           = head;
+    std::string_view status_line    = takeLine(rest);
+    std::string_view connection     = connectionHeader(head);
+    std::string_view name, value;
+    bool             encoded        = false; /* Has `Transfer-Encoding' */
+    bool             chunked        = false;
+    bool             has_length     = false;
+    std::uint64_t    content_length = 0;
+
+    // `HTTP/1.1 200 OK'
+    if (!status_line.starts_with("HTTP/1.") || status_line.size() < 12 ||
+        std::from_chars(status_line.data() + 9, status_line.data() + 12,
+                        status)
+                .ec != std::errc())
+        return false;
+
+    // Connection upgrades are not proxied
+    if (status == 101)
+        return false;
+
+    if (status_line.starts_with("HTTP/1.0"))
+        keep_alive = listsToken(connection, "keep-alive");
+    if (listsToken(connection, "close"))
+        keep_alive = false;
+
+    for (std::string_view lines = rest; !lines.empty();)
+        if (splitHeader(takeLine(lines), name, value) &&
+            equalsIgnoreCase(name, "Transfer-Encoding"))
+        {
+            // Only the final coding delimits the body
+            std::size_t last_comma = value.rfind(',');
+            encoded                = true;
+            chunked                = equalsIgnoreCase(
+                trim(last_comma == std::string_view::npos
+                                        ? value
+                                        : value.substr(last_comma + 1)),
+                "chunked");
+        }
+
+    std::string rewritten;
+    rewritten.reserve(head.size());
+    rewritten.append(status_line).append("\r\n");
+
+    while (!rest.empty())
+    {
+        std::string_view line = takeLine(rest);
+
+        if (!splitHeader(line, name, value) || isHopByHop(name, connection))
+            continue;
+
+        // `Transfer-Encoding' overrides it, and the client must not see
+        // both (RFC 9112 §6.3)
+        if (equalsIgnoreCase(name, "Content-Length"))
+        {
+            if (encoded)
+                continue;
+
+            has_length = std::from_chars(value.data(),
+                                         value.data() + value.size(),
+                                         content_length)
+                             .ec == std::errc();
+        }
+
+        rewritten.append(line).append("\r\n");
+    }
+
+    bool interim = status >= 100 && status < 200;
+
+    if (interim)
+        state = State::HEAD; /* The final response follows */
+    else if (head_request || status == 204 || status == 304)
+        state = State::DONE;
+    else if (chunked)
+        state = State::CHUNK_SIZE;
+    else if (has_length)
+        state = content_length == 0 ? State::DONE : State::LENGTH;
+    else
+    {
+        state        = State::UNTIL_CLOSE;
+        keep_alive   = false;
+        close_client = true;
+    }
+
+    left = content_length;
+
+    if (close_client && !interim)
+        rewritten.append("Connection: close\r\n");
+    rewritten.append("\r\n");
+
+    relay.append(rewritten);
+    started = true;
+    head.clear();
+
+    return true;
+}
+
+std::size_t proxy::ResponseReader::FeedChunked(std::string_view data)
+{
+    std::size_t consumed = 0;
+
+    while (consumed < data.size() && state != State::DONE)
+    {
+        std::string_view rest = data.substr(consumed);
+
+        if (state == State::CHUNK_DATA)
+        {
+            std::size_t taken = std::min<std::uint64_t>(left, rest.size());
+            consumed += taken;
+            left -= taken;
+            if (left == 0)
+                state = State::CHUNK_SIZE;
+            continue;
+        }
+
+        // Size and trailer lines may arrive in pieces
+        std::size_t line_end = rest.find('\n');
+        std::size_t taken =
+            line_end == std::string_view::npos ? rest.size() : line_end + 1;
+
+        line.append(rest.substr(0, taken));
+        consumed += taken;
+
+        if (line.size() > MAX_LINE_LENGTH)
+        {
+            // Not framing we can follow: relay until the upstream closes
+            state        = State::UNTIL_CLOSE;
+            keep_alive   = false;
+            close_client = true;
+            return data.size();
+        }
+
+        if (line_end == std::string_view::npos)
+            continue;
+
+        std::string_view complete = trim(line);
+        if (complete.ends_with('\n'))
+            complete.remove_suffix(1);
+        if (complete.ends_with('\r'))
+            complete.remove_suffix(1);
+
+        if (state == State::CHUNK_TRAILER)
+        {
+            if (complete.empty())
+                state = State::DONE;
+        }
+        else
+        {
+            std::uint64_t size = 0;
+            auto          result =
+                std::from_chars(complete.data(),
+                                complete.data() + complete.size(), size, 16);
+
+            if (result.ec != std::errc())
+            {
+                state        = State::UNTIL_CLOSE;
+                keep_alive   = false;
+                close_client = true;
+                return data.size();
+            }
+
+            // The chunk data is followed by CRLF
+            left  = size + 2;
+            state = size == 0 ? State::CHUNK_TRAILER : State::CHUNK_DATA;
+        }
+
+        line.clear();
+    }
+
+    return consumed;
+}
+
+bool proxy::ResponseReader::FeedClose()
+{
+    if (state == State::UNTIL_CLOSE)
+        state = State::DONE;
+
+    keep_alive = false;
+
+    return state == State::DONE;
+}
+
+proxy::Pool::~Pool()
+{
+    for (Upstream & upstream : upstreams)
+    {
+        for (int fd : upstream.idle)
+            close(fd);
+        if (upstream.probe_fd >= 0)
+            close(upstream.probe_fd);
+    }
+}
+
+std::size_t proxy::Pool::AddUpstream(std::string_view name)
+{
+    for (std::size_t i = 0; i < upstreams.size(); i++)
+        if (upstreams[i].name == name)
+            return i;
+
+    Upstream upstream;
+    upstream.name = name;
+    std::memset(&upstream.address, 0, sizeof(upstream.address));
+
+    if (name.starts_with("unix:"))
+    {
+        auto & address = reinterpret_cast<sockaddr_un &>(upstream.address);
+        std::string_view path = name.substr(5);
+
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+            return NO_UPSTREAM;
+
+        address.sun_family = AF_UNIX;
+        path.copy(address.sun_path, path.size());
+        upstream.address_length = sizeof(address);
+    }
+    else
+    {
+        std::size_t colon = name.rfind(':');
+        int         port  = 0;
+
+        if (colon == std::string_view::npos ||
+            std::from_chars(name.data() + colon + 1, name.data() + name.size(),
+                            port)
+                    .ec != std::errc() ||
+            port <= 0 || port > 65535)
+            return NO_UPSTREAM;
+
+        // Addresses are literal, resolving names would block the loop
+        std::string host(name.substr(0, colon));
+        if (host == "localhost")
+            host = "127.0.0.1";
+
+        auto & address4 = reinterpret_cast<sockaddr_in &>(upstream.address);
+        auto & address6 = reinterpret_cast<sockaddr_in6 &>(upstream.address);
+
+        if (inet_pton(AF_INET, host.c_str(), &address4.sin_addr) == 1)
+        {
+            address4.sin_family     = AF_INET;
+            address4.sin_port       = htons(port);
+            upstream.address_length = sizeof(address4);
+        }
+        else if (host.size() > 2 && host.front() == '[' &&
+                 host.back() == ']' &&
+                 inet_pton(AF_INET6, host.substr(1, host.size() - 2).c_str(),
+                           &address6.sin6_addr) == 1)
+        {
+            address6.sin6_family    = AF_INET6;
+            address6.sin6_port      = htons(port);
+            upstream.address_length = sizeof(address6);
+        }
+        else
+            return NO_UPSTREAM;
+    }
+
+    upstreams.push_back(std::move(upstream));
+
+    return upstreams.size() - 1;
+}
+
+bool proxy::Pool::Configure(const std::string & spec)
+{
+    std::size_t equal = spec.find('=');
+
+    if (equal == std::string::npos || !spec.starts_with('/'))
+        return false;
+
+    Route            route;
+    std::string_view list = std::string_view(spec).substr(equal + 1);
+
+    route.prefix = spec.substr(0, equal);
+
+    while (!list.empty())
+    {
+        std::size_t comma    = list.find(',');
+        std::size_t upstream = AddUpstream(list.substr(0, comma));
+
+        if (upstream == NO_UPSTREAM)
+            return false;
+
+        route.upstreams.push_back(upstream);
+        list.remove_prefix(comma == std::string_view::npos ? list.size()
+                                                           : comma + 1);
+    }
+
+    if (route.upstreams.empty())
+        return false;
+
+    routes.push_back(std::move(route));
+
+    return true;
+}
+
+proxy::Route * proxy::Pool::Match(std::string_view target)
+{
+    Route * longest = nullptr;
+
+    for (Route & route : routes)
+    {
+        if (!target.starts_with(route.prefix) ||
+            (longest && longest->prefix.size() >= route.prefix.size()))
+            continue;
+
+        // `/api' matches `/api/users' and `/api?x' but not `/apiary'
+        if (target.size() == route.prefix.size() ||
+            route.prefix.ends_with('/') ||
+            target[route.prefix.size()] == '/' ||
+            target[route.prefix.size()] == '?')
+            longest = &route;
+    }
+
+    return longest;
+}
+
+std::size_t proxy::Pool::Pick(Route & route)
+{
+    std::size_t count = route.upstreams.size();
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::size_t upstream = route.upstreams[(route.next + i) % count];
+
+        if (upstreams[upstream].healthy)
+        {
+            route.next = (route.next + i + 1) % count;
+            return upstream;
+        }
+    }
+
+    return NO_UPSTREAM;
+}
+
+/**
+ *@brief Open a non-blocking socket and start connecting it
+ *
+ * @param connected set when the connect finished right away
+ * @return int the socket, or -1 with `errno' set
+ */
+static int connectTo(const proxy::Upstream & upstream, bool & connected)
+{
+    int fd = socket(upstream.address.ss_family,
+                    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0)
+        return -1;
+
+    if (upstream.address.ss_family != AF_UNIX)
+    {
+        int no_delay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    }
+
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&upstream.address),
+                upstream.address_length) == 0)
+    {
+        connected = true;
+        return fd;
+    }
+
+    if (errno == EINPROGRESS)
+    {
+        connected = false;
+        return fd;
+    }
+
+    int error = errno;
+    close(fd);
+    errno = error;
+
+    return -1;
+}
+
+int proxy::Pool::Acquire(std::size_t upstream, bool & connected,
+                         bool & reused)
+{
+    std::vector<int> & idle = upstreams[upstream].idle;
+
+    reused = false;
+
+    while (!idle.empty())
+    {
+        int  fd = idle.back();
+        char byte;
+        idle.pop_back();
+
+        // An idle connection has nothing to read unless the upstream closed it
+        if (recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+            (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            connected = true;
+            reused    = true;
+            return fd;
+        }
+
+        close(fd);
+    }
+
+    return Connect(upstream, connected);
+}
+
+int proxy::Pool::Connect(std::size_t upstream, bool & connected)
+{
+    int fd = connectTo(upstreams[upstream], connected);
+
+    // A full listen queue is load, not a dead upstream
+    if (fd < 0 && errno != EAGAIN)
+        MarkDown(upstream);
+
+    return fd;
+}
+
+void proxy::Pool::Release(std::size_t upstream, int fd)
+{
+    if (upstreams[upstream].idle.size() < MAX_IDLE_CONNECTIONS)
+        upstreams[upstream].idle.push_back(fd);
+    else
+        close(fd);
+
+    return;
+}
+
+void proxy::Pool::MarkDown(std::size_t upstream)
+{
+    if (upstreams[upstream].healthy)
+        std::cerr << "Upstream " << upstreams[upstream].name << " is down\n";
+
+    upstreams[upstream].healthy = false;
+
+    // Its idle connections are as dead as it is
+    for (int fd : upstreams[upstream].idle)
+        close(fd);
+    upstreams[upstream].idle.clear();
+
+    return;
+}
+
+void proxy::Pool::CheckHealth(Clock::time_point now)
+{
+    if (now < next_health_check)
+        return;
+
+    next_health_check = now + HEALTH_CHECK_INTERVAL;
+
+    for (std::size_t i = 0; i < upstreams.size(); i++)
+    {
+        Upstream &          upstream = upstreams[i];
+        std::optional<bool> healthy;
+
+        // A connect still pending after a whole interval is a failure
+        if (upstream.probe_fd >= 0)
+        {
+            pollfd    probe = {upstream.probe_fd, POLLOUT, 0};
+            int       error = 0;
+            socklen_t size  = sizeof(error);
+
+            healthy = poll(&probe, 1, 0) == 1 && (probe.revents & POLLOUT) &&
+                      getsockopt(upstream.probe_fd, SOL_SOCKET, SO_ERROR,
+                                 &error, &size) == 0 &&
+                      error == 0;
+
+            close(upstream.probe_fd);
+            upstream.probe_fd = -1;
+        }
+
+        bool connected = false;
+        int  fd        = connectTo(upstream, connected);
+
+        if (fd >= 0 && !connected)
+            upstream.probe_fd = fd; /* Judged in the next round */
+        else
+        {
+            healthy = fd >= 0 || errno == EAGAIN;
+            if (fd >= 0)
+                close(fd);
+        }
+
+        if (!healthy.has_value())
+            continue;
+
+        if (!*healthy)
+        {
+            MarkDown(i);
+            continue;
+        }
+
+        if (!upstream.healthy)
+            std::cerr << "Upstream " << upstream.name << " is up\n";
+
+        upstream.healthy = true;
+    }
+
+    return;
+}
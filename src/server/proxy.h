@@ -0,0 +1,268 @@
+#ifndef _PROXY_H_
+#define _PROXY_H_
+
+#include "trace.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <vector>
+
+#define BEGIN_PROXY_NAMESPACE \
+    namespace proxy           \
+    {
+#define END_PROXY_NAMESPACE }
+
+BEGIN_PROXY_NAMESPACE
+
+using Clock = std::chrono::steady_clock;
+
+// Returned when a route has no healthy upstream
+constexpr std::size_t NO_UPSTREAM = static_cast<std::size_t>(-1);
+
+/**
+ *@brief A backend server on localhost or a Unix socket
+ */
+struct Upstream
+{
+    std::string      name; /* As configured, e.g. `127.0.0.1:8080' */
+    sockaddr_storage address;
+    socklen_t        address_length = 0;
+
+    bool             healthy  = true;
+    int              probe_fd = -1; /* Health check connect in progress */
+    std::vector<int> idle;          /* Keep-alive connections to reuse */
+};
+
+/**
+ *@brief Requests whose path starts with `prefix' go to `upstreams'
+ */
+struct Route
+{
+    std::string              prefix;
+    std::vector<std::size_t> upstreams; /* Indices into the pool */
+    std::size_t              next = 0;  /* Round-robin position */
+};
+
+/**
+ *@brief Follow an upstream response as it streams through, rewriting its
+ * head for the client and finding where its body ends
+ */
+class ResponseReader
+{
+private:
+    enum class State
+    {
+        HEAD,
+        LENGTH,        /* `Content-Length' bytes of body */
+        CHUNK_SIZE,    /* `chunked' framing, a size line */
+        CHUNK_DATA,    /* Chunk data and its CRLF */
+        CHUNK_TRAILER, /* Trailer lines up to the empty line */
+        UNTIL_CLOSE,   /* No framing, the body ends with the connection */
+        DONE,
+    };
+
+    State         state = State::HEAD;
+    std::string   head;       /* Head received so far */
+    std::string   line;       /* Partial chunk size or trailer line */
+    std::uint64_t left   = 0; /* Body or chunk bytes still expected */
+    int           status = 0;
+    bool          head_request;
+    bool          close_client;
+    bool          keep_alive = true;
+    bool          started    = false; /* Bytes were relayed to the client */
+
+    /**
+     *@brief Parse the complete head and relay it without hop-by-hop headers
+     *
+     * @return false the head is malformed
+     */
+    bool FinishHead(std::string & relay);
+
+    /**
+     *@brief Consume `chunked' framing up to the end of the body
+     *
+     * @return std::size_t the bytes of `data' that belong to the body
+     */
+    std::size_t FeedChunked(std::string_view data);
+
+public:
+    /**
+     *@param head_request the request method is `HEAD', the response has no
+     * body whatever its headers say
+     *@param close_client the client connection closes after the response
+     */
+    ResponseReader(bool head_request, bool close_client)
+        : head_request(head_request), close_client(close_client)
+    {
+    }
+
+    /**
+     *@brief Consume upstream data, appending what the client gets to `relay'
+     *
+     * Data past the end of the response is ignored.
+     *
+     * @return false the response is malformed
+     */
+    bool Feed(std::string_view data, std::string & relay);
+
+    /**
+     *@brief The upstream closed its connection
+     *
+     * @return true the response ended properly
+     */
+    bool FeedClose();
+
+    bool Done() const { return state == State::DONE; }
+
+    /**
+     *@brief Whether part of the response has reached the client
+     */
+    bool Started() const { return started; }
+
+    /**
+     *@brief Whether the upstream connection can serve another request
+     */
+    bool KeepAlive() const { return keep_alive; }
+
+    /**
+     *@brief Whether the client connection has to close after the response
+     */
+    bool ClosesClient() const { return close_client; }
+
+    int GetStatusCode() const { return status; }
+};
+
+/**
+ *@brief A request being forwarded, owned by the client connection
+ */
+struct Exchange
+{
+    std::size_t    upstream;      /* Index into the pool */
+    int            fd;            /* Upstream socket */
+    bool           connected;     /* The non-blocking connect finished */
+    std::string    to_upstream;   /* Request bytes not written yet */
+    std::string    retry; /* The request, until the upstream answers */
+    std::uint64_t  body_left = 0; /* Request body not received yet */
+    ResponseReader reader;
+
+    bool          reading_paused = false; /* Client output above high water */
+    std::uint32_t events         = 0;     /* Registered epoll events */
+
+    trace::RequestTrace request_trace;
+
+    Exchange(std::size_t upstream, int fd, bool connected,
+             ResponseReader reader)
+        : upstream(upstream), fd(fd), connected(connected), reader(reader)
+    {
+    }
+};
+
+/**
+ *@brief The proxy routes and a keep-alive connection pool per upstream,
+ * health-checked by connecting to each upstream periodically
+ */
+class Pool
+{
+private:
+    std::vector<Upstream> upstreams;
+    std::vector<Route>    routes;
+    Clock::time_point     next_health_check;
+
+    /**
+     *@brief Find or add an upstream by its name
+     *
+     * @return std::size_t its index, or `NO_UPSTREAM' if the address is
+     * invalid
+     */
+    std::size_t AddUpstream(std::string_view name);
+
+public:
+    Pool() {}
+    Pool(const Pool &)             = delete;
+    Pool & operator=(const Pool &) = delete;
+    ~Pool();
+
+    /**
+     *@brief Add a route
+     *
+     * @param spec `/prefix=upstream[,upstream...]', where an upstream is
+     * `host:port' on this machine or `unix:/path'
+     * @return true the specification is valid
+     */
+    bool Configure(const std::string & spec);
+
+    bool Empty() const { return routes.empty(); }
+
+    /**
+     *@brief Find the route with the longest prefix of `target'
+     *
+     * @return Route* the route, or nullptr if the request is served here
+     */
+    Route * Match(std::string_view target);
+
+    /**
+     *@brief Pick the next healthy upstream of the route in round-robin
+     *
+     * @return std::size_t the upstream, or `NO_UPSTREAM' if none is healthy
+     */
+    std::size_t Pick(Route & route);
+
+    /**
+     *@brief Get a connection to the upstream, reusing an idle one if possible
+     *
+     * @param upstream the upstream
+     * @param connected set when the connection is usable right away
+     * @param reused set when the connection was idle in the pool
+     * @return int the non-blocking socket, or -1 if connecting failed
+     */
+    int Acquire(std::size_t upstream, bool & connected, bool & reused);
+
+    /**
+     *@brief Open a new connection to the upstream
+     *
+     * @param upstream the upstream
+     * @param connected set when the connection is usable right away
+     * @return int the non-blocking socket, or -1 if connecting failed
+     */
+    int Connect(std::size_t upstream, bool & connected);
+
+    /**
+     *@brief Keep a connection whose response was fully read for reuse
+     */
+    void Release(std::size_t upstream, int fd);
+
+    /**
+     *@brief Stop picking the upstream until a health check passes
+     */
+    void MarkDown(std::size_t upstream);
+
+    const std::string & Name(std::size_t upstream) const
+    {
+        return upstreams[upstream].name;
+    }
+
+    /**
+     *@brief Finish the previous round of health checks and start the next
+     * one if it is due
+     */
+    void CheckHealth(Clock::time_point now);
+
+    Clock::time_point NextHealthCheck() const { return next_health_check; }
+};
+
+/**
+ *@brief Rewrite a request head for an upstream: hop-by-hop headers are
+ * dropped and `X-Forwarded-For' is added
+ *
+ * @param head the request line and headers, ending with the empty line
+ * @param client_address the IPv4 client address, network byte order
+ */
+std::string RewriteRequestHead(std::string_view head,
+                               std::uint32_t    client_address);
+
+END_PROXY_NAMESPACE
+
+#endif // !_PROXY_H_
@@ -1,31 +1,38 @@
 #include "server.h"
+#include "path.h"
 #include <algorithm>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <csignal>
 #include <cstdlib>
 #include <cstring>
-#include <filesystem>
-#include <fstream>
+#include <fcntl.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <utility>
 #include <vector>
-#include <zlib.h>
-
-namespace fs = std::filesystem;
 
 /**
- *@brief Check whether the file exists in current directory
- *
- * @param file_name the name of the file to check
- * @param full_path whether the file name is the full path of the file
- * @return true the file exists
- * @return false the file does not exist
+ *@brief Get the request target from the request line, without parsing the
+ * request
  */
-static bool existFile(const std::string & file_name, bool full_path = false)
+static std::string_view requestTarget(std::string_view head)
 {
-    return !full_path
-               ? (fs::exists(fs::current_path().string() + "/" + file_name) ||
-                  file_name == "/" || file_name.empty())
-               : (fs::exists(file_name));
+    std::size_t start = head.find(' ');
+
+    if (start == std::string_view::npos)
+        return {};
+
+    std::size_t end = head.find_first_of(" \r\n", start + 1);
+
+    return head.substr(start + 1, end == std::string_view::npos
+                                      ? std::string_view::npos
+                                      : end - start - 1);
 }
 
 static void terminateProgram()
@@ -33,6 +40,95 @@ static void terminateProgram()
     std::exit(1);
 }
 
+// Self-pipe that turns signals into a readable fd for the accept loop
+static int signal_pipe[2] = {-1, -1};
+
+static void handleSignal(int)
+{
+    int saved_errno = errno;
+    (void) !write(signal_pipe[1], "s", 1);
+    errno = saved_errno;
+}
+
+/**
+ *@brief Build the address of a Unix socket
+ *
+ * @param path the socket path
+ * @return sockaddr_un the address
+ */
+static sockaddr_un unixAddress(const std::string & path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    return address;
+}
+
+/**
+ *@brief Pass a file descriptor over a Unix socket with `SCM_RIGHTS'
+ *
+ * @param socket_fd the connected Unix socket
+ * @param fd the file descriptor to pass
+ * @return true the descriptor was sent
+ */
+static bool sendFileDescriptor(int socket_fd, int fd)
+{
+    char  byte = 'F';
+    iovec io   = {&byte, 1};
+    char  control[CMSG_SPACE(sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov        = &io;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control;
+    message.msg_controllen = sizeof(control);
+
+    cmsghdr * header    = CMSG_FIRSTHDR(&message);
+    header->cmsg_level  = SOL_SOCKET;
+    header->cmsg_type   = SCM_RIGHTS;
+    header->cmsg_len    = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+    return sendmsg(socket_fd, &message, MSG_NOSIGNAL) == 1;
+}
+
+/**
+ *@brief Receive a file descriptor passed with `SCM_RIGHTS'
+ *
+ * @param socket_fd the connected Unix socket
+ * @return int the received descriptor, or -1
+ */
+static int receiveFileDescriptor(int socket_fd)
+{
+    char  byte;
+    iovec io = {&byte, 1};
+    char  control[CMSG_SPACE(sizeof(int))];
+
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov        = &io;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control;
+    message.msg_controllen = sizeof(control);
+
+    if (recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC) != 1)
+        return -1;
+
+    cmsghdr * header = CMSG_FIRSTHDR(&message);
+    if (header == nullptr || header->cmsg_level != SOL_SOCKET ||
+        header->cmsg_type != SCM_RIGHTS)
+        return -1;
+
+    int fd;
+    std::memcpy(&fd, CMSG_DATA(header), sizeof(int));
+
+    return fd;
+}
+
 int server::Server::InitializeSocket()
 {
     try
@@ -86,9 +182,6 @@ int server::Server::InitializeSocket()
 
 void server::Server::Listen()
 {
-    // The maximum number of connection
-    int connection_backlog = 500;
-
     try
     {
         // Fail to listen
@@ -104,304 +197,1988 @@ void server::Server::Listen()
     return;
 }
 
-int server::Server::AcceptClient()
+void server::Server::InstallSignalHandlers()
 {
-    // Set the client
-    sockaddr_in client_address;
-    int         client_address_length = sizeof(client_address);
+    try
+    {
+        if (pipe2(signal_pipe, O_CLOEXEC | O_NONBLOCK) != 0)
+            throw server::ServerException("Failed to create signal pipe");
+    }
+    catch (const server::ServerException & e)
+    {
+        std::cerr << e.what() << '\n';
+        terminateProgram();
+    }
 
-    std::cout << "Waiting for a client to connect...\n";
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = handleSignal;
+    sigemptyset(&action.sa_mask);
 
-    // Accept the connection from client
-    int client_fd = accept(server_fd, (sockaddr *) &client_address,
-                           (socklen_t *) &client_address_length);
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
 
-    // Return the client_fd
-    return client_fd;
+    // Writing to a closed connection must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    return;
+}
+
+bool server::Server::InheritSocket(const std::string & path)
+{
+    int         socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address   = unixAddress(path);
+
+    // No server is running, so there is nothing to take over
+    if (socket_fd < 0 ||
+        connect(socket_fd, (sockaddr *) &address, sizeof(address)) != 0)
+    {
+        if (socket_fd >= 0)
+            close(socket_fd);
+        return false;
+    }
+
+    server_fd = receiveFileDescriptor(socket_fd);
+    tls_fd    = server_fd < 0 ? -1 : receiveFileDescriptor(socket_fd);
+    close(socket_fd);
+
+    if (server_fd < 0)
+        return false;
+
+    std::cout << "Inherited listening socket from running server\n";
+
+    return true;
 }
 
-std::string server::Server::Receive(int client_fd)
+void server::Server::ListenForUpgrade(const std::string & path)
 {
-    // Received data
-    std::string received(BUFFER_LENGTH, '\0');
-    ssize_t     receive_bytes; /* Received bytes */
+    sockaddr_un address = unixAddress(path);
 
     try
     {
-        // Fail to receive data
-        if ((receive_bytes =
-                 recv(client_fd, &received[0], received.size(), 0)) < 0)
-            throw server::ServerException("receive failed");
+        upgrade_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (upgrade_fd < 0)
+            throw server::ServerException("Failed to create upgrade socket");
+
+        // The path may still be held by the server we took over from
+        unlink(path.c_str());
+
+        if (bind(upgrade_fd, (sockaddr *) &address, sizeof(address)) != 0 ||
+            listen(upgrade_fd, 1) != 0)
+            throw server::ServerException("Failed to listen on " + path);
     }
     catch (const server::ServerException & e)
     {
         std::cerr << e.what() << '\n';
+        terminateProgram();
     }
 
-    // Resize the received data
-    received.resize(receive_bytes);
-
-    /*
-    If the receive_bytes is 0, it means the connection is closed.
-    By returning empty string, the main program can handle the situation.
-    */
-    return receive_bytes == 0 ? "" : received;
+    return;
 }
 
-void server::Server::Send(int client_fd, const std::string & message)
+void server::Server::ListenTls()
 {
+    // An inherited TLS socket is only used with a certificate
+    if (!tls_context.Enabled())
+    {
+        if (tls_fd >= 0)
+            close(tls_fd);
+        tls_fd = -1;
+        return;
+    }
+
     try
     {
-        if (send(client_fd, message.c_str(), message.size(), 0) < 0)
-            throw server::ServerException("send failed");
+        if (!tls_context.Initialize())
+            throw server::ServerException("Failed to load the certificate");
+
+        if (tls_fd >= 0)
+            return;
+
+        tls_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (tls_fd < 0)
+            throw server::ServerException("Failed to create TLS socket");
+
+        int reuse = 1;
+        setsockopt(tls_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in tls_address;
+        std::memset(&tls_address, 0, sizeof(tls_address));
+        tls_address.sin_family      = AF_INET;
+        tls_address.sin_addr.s_addr = INADDR_ANY;
+        tls_address.sin_port        = htons(tls_context.GetPort());
+
+        if (bind(tls_fd, (sockaddr *) &tls_address, sizeof(tls_address)) != 0 ||
+            listen(tls_fd, connection_backlog) != 0)
+            throw server::ServerException(
+                "Failed to listen on TLS port " +
+                std::to_string(tls_context.GetPort()));
     }
-    catch (const ServerException & e)
+    catch (const server::ServerException & e)
     {
         std::cerr << e.what() << '\n';
+        terminateProgram();
     }
 
     return;
 }
 
-void server::Server::HandleClient(int client_fd)
+void server::Server::HandOffSocket()
 {
-    std::string received_message;
+    int socket_fd = accept4(upgrade_fd, nullptr, nullptr, SOCK_CLOEXEC);
 
-    while (true)
+    if (socket_fd < 0)
+        return;
+
+    // Keep serving if the new process could not take the sockets
+    if (sendFileDescriptor(socket_fd, server_fd) &&
+        (tls_fd < 0 || sendFileDescriptor(socket_fd, tls_fd)))
     {
-        // If the received message is empty, then the connection is closed
-        if ((received_message = this->Receive(client_fd)) == "")
-            break;
+        std::cout << "Handed listening socket to new server\n";
+        accepting = false;
+    }
 
-        http_message.SetRequest(received_message);
+    close(socket_fd);
 
-        // Clear the response before setting
-        http_message.GetResponsePointer()->Clear();
+    return;
+}
 
-        // Set the `Connection' header in response
-        HandleConnectionClose();
+int server::Server::AcceptClient(int listen_fd)
+{
+    // Set the client
+    sockaddr_in client_address;
+    int         client_address_length = sizeof(client_address);
 
-        // If the method is POST
-        if (http_message.GetRequestPointer()->GetHttpMethod() == "POST")
-            this->HandlePOSTMethod(
-                client_fd, http_message.GetRequestPointer()->GetParsedPath());
-        else /* By default, handle GET method */
-            this->HandleGETMethod(client_fd);
+    // Accept the connection from client
+    int client_fd = accept4(listen_fd, (sockaddr *) &client_address,
+                            (socklen_t *) &client_address_length,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC);
 
-        // This connection is not persistent
-        if (http_message.GetRequestPointer()->GetHeaderLines().at(
-                "Connection") == "close")
-            break;
-    }
+    if (client_fd < 0)
+        return -1;
 
-    std::cout << "Connection closed\n";
+    // Shed load before spending anything on the connection
+    bool shed = !admission_control.AdmitConnection(
+        connections.size(),
+        admission_control.ShedsOnQueueDepth() ? AcceptQueueDepth() : 0);
 
-    // Close the client file descriptor
-    close(client_fd);
+    // A TLS client could not read a plaintext 503
+    if (shed && listen_fd == server_fd)
+    {
+        const std::string & response = admission_control.GetOverloadResponse();
+        send(client_fd, response.data(), response.size(), MSG_NOSIGNAL);
+    }
 
-    return;
-}
+    Connection & connection =
+        connections
+            .try_emplace(client_fd, client_fd, client_address.sin_addr.s_addr)
+            .first->second;
+    connection.id = next_connection_id++;
 
-void server::Server::SetResponse()
-{
-    const std::vector<std::string> & request_path =
-        http_message.GetRequestPointer()->GetParsedPath();
+    if (listen_fd == tls_fd && !shed)
+    {
+        connection.tls = tls_context.NewSession(client_fd);
 
-    if (request_path.at(0) == "echo")
-        HandleEcho(request_path);
-    else if (request_path.at(0) == "user-agent")
-        HandleUserAgent();
-    else if (request_path.at(0) == "files")
-        HandleFile(request_path);
-    else
-        HandleDefault();
+        if (!connection.tls)
+        {
+            connections.erase(client_fd);
+            close(client_fd);
+            return client_fd;
+        }
+    }
 
-    HandleCompression();
-    http_message.GetResponsePointer()->MakeResponse();
+    epoll_event event;
+    event.events  = connection.events = EPOLLIN;
+    event.data.fd = client_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event);
 
-    return;
+    // Its request may not even have arrived yet
+    if (shed)
+        LingerConnection(connection);
+
+    // Return the client_fd
+    return client_fd;
 }
 
-void server::Server::HandleEcho(const std::vector<std::string> & request_path)
+void server::Server::Run(std::chrono::milliseconds drain_timeout)
 {
     try
     {
-        http_message.GetResponsePointer()->SetBody(request_path.at(1));
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0)
+            throw server::ServerException("Failed to create epoll instance");
     }
-    catch (const std::out_of_range & e)
+    catch (const server::ServerException & e)
     {
-        std::cout << e.what() << '\n';
+        std::cerr << e.what() << '\n';
+        terminateProgram();
     }
 
-    http_message.GetResponsePointer()->SetHeaderLine("Content-Type",
-                                                     "text/plain");
+    try
+    {
+        if (!worker_pool.Start())
+            throw server::ServerException("Failed to start the worker pool");
+    }
+    catch (const server::ServerException & e)
+    {
+        std::cerr << e.what() << '\n';
+        terminateProgram();
+    }
 
-    return;
-}
+    for (int fd : {server_fd, tls_fd})
+        if (fd >= 0)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 
-void server::Server::HandleUserAgent()
-{
-    http_message.GetResponsePointer()->SetBody(
-        http_message.GetRequestPointer()->GetHeaderLines("User-Agent"));
+    for (int fd : {server_fd, tls_fd, signal_pipe[0], upgrade_fd,
+                   worker_pool.GetCompletionFd()})
+    {
+        if (fd < 0)
+            continue;
 
-    http_message.GetResponsePointer()->SetHeaderLine("Content-Type",
-                                                     "text/plain");
+        epoll_event event;
+        event.events  = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
 
-    return;
-}
+    enum { MAX_EVENTS = 256 };
+    epoll_event                           events[MAX_EVENTS];
+    std::chrono::steady_clock::time_point deadline;
 
-void server::Server::HandleFile(const std::vector<std::string> & request_path)
-{
-    // If the file exists
-    if (existFile(request_path.at(1)))
+    while (accepting || !connections.empty())
     {
-        http_message.GetResponsePointer()->SetStatusCode(200);
-        http_message.GetResponsePointer()->SetHeaderLine(
-            "Content-Type", "application/octet-stream");
+        int timeout = -1;
 
-        std::ifstream      fin;
-        std::ostringstream oss;
-        char               ch;
+        if (draining)
+        {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
 
-        try
+            if (left.count() <= 0)
+                break;
+            timeout = left.count();
+        }
+
+        // Wake up for the upstream health checks
+        if (!proxy_pool.Empty())
+        {
+            auto left = std::max<std::chrono::milliseconds::rep>(
+                std::chrono::ceil<std::chrono::milliseconds>(
+                    proxy_pool.NextHealthCheck() -
+                    std::chrono::steady_clock::now())
+                    .count(),
+                0);
+
+            timeout = timeout < 0 ? left : std::min<int>(timeout, left);
+        }
+
+        // Wake up for the first lingering connection to close
+        if (!lingering.empty())
         {
-            // Open the file
-            fin.open(fs::current_path().string() + "/" + request_path.at(1),
-                     std::ios::binary);
+            auto left = std::max<std::chrono::milliseconds::rep>(
+                std::chrono::ceil<std::chrono::milliseconds>(
+                    lingering.front().until - std::chrono::steady_clock::now())
+                    .count(),
+                0);
 
-            // If open failed
-            if (fin.fail())
-                throw server::ServerException("fail to open file");
+            timeout = timeout < 0 ? left : std::min<int>(timeout, left);
         }
-        catch (const server::ServerException & e)
+
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+
+        for (int i = 0; i < count; i++)
         {
-            std::cerr << e.what() << '\n';
+            int fd = events[i].data.fd;
+
+            if ((fd == server_fd || fd == tls_fd) && accepting)
+                while (AcceptClient(fd) >= 0);
+            else if (fd == signal_pipe[0])
+            {
+                // SIGTERM or SIGINT: stop accepting and drain
+                char drained[16];
+                while (read(signal_pipe[0], drained, sizeof(drained)) > 0);
+                accepting = false;
+            }
+            else if (fd == upgrade_fd && accepting)
+                HandOffSocket(); /* A new process asks for the socket */
+            else if (fd == worker_pool.GetCompletionFd())
+                worker_pool.RunCompletions();
+            else
+            {
+                auto it = connections.find(fd);
+                if (it == connections.end())
+                {
+                    auto upstream = upstream_clients.find(fd);
+                    if (upstream != upstream_clients.end())
+                        HandleUpstream(connections.at(upstream->second),
+                                       events[i].events);
+                    continue;
+                }
+
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    HandleReadable(it->second);
+                else if (events[i].events & EPOLLOUT)
+                    FlushConnection(it->second);
+            }
         }
 
-        // Read the file content
-        while (fin.get(ch)) oss << ch;
+        if (!proxy_pool.Empty())
+            proxy_pool.CheckHealth(std::chrono::steady_clock::now());
+
+        ExpireLingering(std::chrono::steady_clock::now());
 
-        fin.close(); /* Close the file */
-        http_message.GetResponsePointer()->SetBody(oss.str());
+        if (!accepting && !draining)
+        {
+            deadline = std::chrono::steady_clock::now() + drain_timeout;
+            StartDrain();
+        }
     }
-    else
-        http_message.GetResponsePointer()->SetStatusCode(404);
+
+    if (!connections.empty())
+        std::cerr << "Drain deadline reached, closing " << connections.size()
+                  << " connections\n";
+
+    while (!connections.empty()) CloseConnection(connections.begin()->first);
+
+    close(epoll_fd);
 
     return;
 }
 
-void server::Server::HandleDefault()
+void server::Server::StartDrain()
 {
-    http_message.GetResponsePointer()->SetStatusCode(
-        existFile(http_message.GetRequestPointer()->GetFullPath(), true) ? 200
-                                                                         : 404);
+    draining = true;
+
+    /**
+     * Once the socket is closed the port is released, unless it has been
+     * handed to a new process which keeps accepting on it. The socket is
+     * removed from epoll first since the new process still holds it open.
+     */
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server_fd, nullptr);
+    close(server_fd);
+    if (tls_fd >= 0)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, tls_fd, nullptr);
+        close(tls_fd);
+    }
+    if (upgrade_fd >= 0)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, upgrade_fd, nullptr);
+        close(upgrade_fd);
+    }
+
+    std::cout << "Draining " << connections.size() << " connections\n";
+
+    std::vector<int> idle;
+
+    for (auto & [client_fd, connection] : connections)
+    {
+        // Let HTTP/2 clients finish their open streams
+        if (connection.http2)
+        {
+            connection.http2->GoAway();
+            PumpHttp2(connection);
+        }
+
+        if (connection.input.empty() && connection.output.Empty() &&
+            !connection.proxy && !connection.handler)
+            idle.push_back(client_fd);
+    }
+
+    for (int client_fd : idle) CloseConnection(client_fd);
+
+    for (auto & [client_fd, connection] : connections)
+        UpdateEvents(connection);
 
     return;
 }
 
-void server::Server::HandleGETMethod(int client_fd)
+void server::Server::UpdateEvents(Connection & connection)
 {
-    this->SetResponse();
-    this->Send(client_fd, http_message.GetResponsePointer()->GetResponse());
+    std::uint32_t events = 0;
+
+    if (connection.lingering ||
+        (!connection.reading_paused && !connection.close_after_flush &&
+         !connection.peer_closed && !connection.InputFull()))
+        events |= EPOLLIN;
+    if (!connection.output.Empty() ||
+        (connection.tls && connection.tls->WantsWrite()))
+        events |= EPOLLOUT;
+
+    if (events == connection.events)
+        return;
+
+    epoll_event event;
+    event.events  = connection.events = events;
+    event.data.fd = connection.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+
+    return;
 }
 
-void server::Server::HandlePOSTMethod(
-    int client_fd, const std::vector<std::string> & request_path)
+void server::Server::HandleReadable(Connection & connection)
 {
-    std::ofstream fout;
-
-    try
-    {
-        fout.open(fs::current_path().string() + "/" + request_path.at(1),
-                  std::ios::binary);
+    char         buffer[BUFFER_LENGTH];
+    std::size_t  received = 0;
+    trace::Ticks woke     = trace::Now();
 
-        // Fail to open the file
-        if (fout.fail())
-            throw server::ServerException("fail to write file");
-    }
-    catch (const server::ServerException & e)
+    if (connection.lingering)
     {
-        std::cerr << e.what() << '\n';
+        DiscardInput(connection);
         return;
     }
 
-    // Write the file and close the file
-    fout << http_message.GetRequestPointer()->GetBody();
-    fout.close();
+    if (connection.tls && !AdvanceHandshake(connection))
+        return;
 
-    // Set the response
-    http_message.GetResponsePointer()->SetStatusCode(201);
+    // Bound the work per wakeup so one client cannot starve the others
+    while (received < HIGH_WATER_MARK && !connection.InputFull())
+    {
+        ssize_t receive_bytes =
+            connection.tls ? connection.tls->Read(buffer, sizeof(buffer))
+                           : recv(connection.fd, buffer, sizeof(buffer), 0);
 
-    // Make the response and send it
-    http_message.GetResponsePointer()->MakeResponse();
-    this->Send(client_fd, http_message.GetResponsePointer()->GetResponse());
+        if (receive_bytes > 0)
+        {
+            if (connection.input_since == 0)
+                connection.input_since = woke;
+
+            connection.input.append(buffer, receive_bytes);
+            received += receive_bytes;
+            continue;
+        }
+
+        // If the receive_bytes is 0, it means the connection is closed
+        if (receive_bytes == 0)
+        {
+            connection.peer_closed = true;
+            break;
+        }
+
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+
+        CloseConnection(connection.fd);
+        return;
+    }
+
+    ProcessInput(connection);
+    FlushConnection(connection);
 
     return;
 }
 
-void server::Server::HandleCompression()
+bool server::Server::FlushConnection(Connection & connection)
 {
-    std::vector<std::string> compression_options =
-        http_message.GetRequestPointer()->GetCompressionOptions();
+    // The handshake may be waiting for a writable socket
+    if (connection.tls && !connection.tls->Established())
+    {
+        int client_fd = connection.fd;
+
+        // Records decrypted along with the handshake are read right away
+        if (AdvanceHandshake(connection))
+            HandleReadable(connection);
+
+        return connections.contains(client_fd);
+    }
 
-    if (std::find(compression_options.begin(), compression_options.end(),
-                  "gzip") != compression_options.end())
+    while (true)
     {
-        http_message.GetResponsePointer()->SetHeaderLine("Content-Encoding",
-                                                         "gzip");
+        if (connection.output.Flush(connection.fd, connection.tls.get()) ==
+            OutputQueue::FlushResult::ERROR)
+        {
+            CloseConnection(connection.fd);
+            return false;
+        }
+
+        // Finish the traces of the responses now fully written
+        while (!connection.sending.empty() &&
+               connection.sending.front().send_end <=
+                   connection.output.Written())
+        {
+            connection.sending.front().End(trace::Phase::SEND);
+            tracer.Finish(connection.sending.front());
+            connection.sending.pop_front();
+        }
+
+        // Relay more of the upstream response once the client caught up
+        if (connection.proxy && connection.proxy->reading_paused &&
+            connection.output.Size() < LOW_WATER_MARK)
+        {
+            connection.proxy->reading_paused = false;
+            UpdateUpstreamEvents(connection);
+        }
+
+        // Frame more HTTP/2 response data once the client caught up
+        if (connection.http2 && connection.output.Size() < LOW_WATER_MARK &&
+            connection.http2->HasPendingData())
+        {
+            PumpHttp2(connection);
+            continue;
+        }
+
+        // Let a handler waiting for the client to catch up write more
+        if (connection.handler && connection.handler->waiting_output &&
+            connection.output.Size() < LOW_WATER_MARK)
+        {
+            if (ResumeHandler(connection))
+                ProcessInput(connection);
+            continue;
+        }
 
-        // Compress the body
-        http_message.GetResponsePointer()->SetBody(
-            GzipCompression(http_message.GetResponsePointer()->GetBody()));
+        // Serve the requests that arrived while reads were paused
+        if (!connection.reading_paused ||
+            connection.output.Size() >= LOW_WATER_MARK)
+            break;
+
+        connection.reading_paused = false;
+        ProcessInput(connection);
     }
 
-    return;
+    if (connection.output.Empty() && !connection.proxy &&
+        !connection.handler &&
+        (connection.close_after_flush || connection.peer_closed ||
+         connection.input.size() > MAX_REQUEST_LENGTH))
+    {
+        // Whatever the client sends next is not read
+        if (connection.peer_closed)
+            CloseConnection(connection.fd);
+        else
+            LingerConnection(connection);
+        return false;
+    }
+
+    UpdateEvents(connection);
+
+    return true;
 }
 
-std::string server::Server::GzipCompression(const std::string & data)
+void server::Server::LingerConnection(Connection & connection)
 {
-    z_stream zs;
-    std::memset(&zs, 0, sizeof(zs));
+    // Sends the TLS close_notify, the session is not used any further
+    if (connection.tls)
+    {
+        connection.tls->Shutdown();
+        connection.tls.reset();
+    }
 
-    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
-                     Z_DEFAULT_STRATEGY) != Z_OK)
-        throw std::runtime_error("deflateInit2 failed while compressing.");
+    shutdown(connection.fd, SHUT_WR);
 
-    zs.next_in  = (Bytef *) data.data();
-    zs.avail_in = data.size();
+    connection.lingering = true;
+    connection.input.clear();
+    lingering.push_back({std::chrono::steady_clock::now() + LINGER_TIMEOUT,
+                         connection.fd, connection.id});
 
-    int         ret;
-    char        outbuffer[32768];
-    std::string outstring;
+    UpdateEvents(connection);
+    DiscardInput(connection);
 
-    do
-    {
-        zs.next_out  = reinterpret_cast<Bytef *>(outbuffer);
-        zs.avail_out = sizeof(outbuffer);
-        ret          = deflate(&zs, Z_FINISH);
+    return;
+}
 
-        if (outstring.size() < zs.total_out)
-            outstring.append(outbuffer, zs.total_out - outstring.size());
+void server::Server::DiscardInput(Connection & connection)
+{
+    char        discarded[BUFFER_LENGTH];
+    std::size_t received = 0;
 
-    } while (ret == Z_OK);
+    // Bound the work per wakeup like `HandleReadable()'
+    while (received < HIGH_WATER_MARK)
+    {
+        ssize_t receive_bytes =
+            recv(connection.fd, discarded, sizeof(discarded), 0);
 
-    deflateEnd(&zs);
+        if (receive_bytes > 0)
+        {
+            received += receive_bytes;
+            continue;
+        }
 
-    if (ret != Z_STREAM_END)
-        throw std::runtime_error("Exception during zlib compression: (" +
-                                 std::to_string(ret) + ") " + zs.msg);
+        if (receive_bytes < 0 && errno == EINTR)
+            continue;
+        if (receive_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
 
-    return outstring;
+        // The client closed too, or reset the connection
+        break;
+    }
+
+    if (received < HIGH_WATER_MARK)
+        CloseConnection(connection.fd);
+
+    return;
+}
+
+void server::Server::ExpireLingering(std::chrono::steady_clock::time_point now)
+{
+    while (!lingering.empty() && lingering.front().until <= now)
+    {
+        Lingering expired = lingering.front();
+        lingering.pop_front();
+
+        // It may have closed already, and its fd been reused meanwhile
+        auto it = connections.find(expired.fd);
+        if (it != connections.end() && it->second.id == expired.id &&
+            it->second.lingering)
+            CloseConnection(expired.fd);
+    }
+
+    return;
+}
+
+void server::Server::ProcessInput(Connection & connection)
+{
+    constexpr std::string_view preface = http2::Session::CLIENT_PREFACE;
+
+    while (!connection.close_after_flush && !connection.reading_paused)
+    {
+        // The request body streams to the upstream as it arrives
+        if (connection.proxy)
+        {
+            if (connection.peer_closed && connection.input.empty() &&
+                connection.proxy->body_left > 0)
+                FailProxy(connection, 502);
+            else if (!PumpRequestBody(connection))
+                FailProxy(connection, 502);
+            break;
+        }
+
+        // A coroutine handler has the connection until it finishes
+        if (connection.handler)
+        {
+            if (!ResumeHandler(connection))
+                break;
+            continue;
+        }
+
+        if (connection.http2)
+        {
+            connection.http2->Feed(connection.input);
+            connection.input.clear();
+
+            // Let the client finish its open streams and stop opening new
+            if (draining)
+                connection.http2->GoAway();
+
+            PumpHttp2(connection);
+            break;
+        }
+
+        // HTTP/2 with prior knowledge
+        if (connection.input.starts_with(preface))
+        {
+            connection.http2 = MakeHttp2Session(connection);
+            connection.http2->Start();
+            continue;
+        }
+
+        if (connection.input.size() < preface.size() &&
+            preface.starts_with(connection.input))
+            break;
+
+        std::size_t head_length = message::Message::HeadLength(connection.input);
+
+        if (head_length == 0)
+            break;
+
+        // A proxied request is forwarded once its head is complete, and an
+        // upload is written as its body arrives
+        proxy::Route * route =
+            proxy_pool.Empty()
+                ? nullptr
+                : proxy_pool.Match(requestTarget(connection.input));
+        bool upload = !route && connection.input.starts_with("POST ");
+        std::optional<std::uint64_t> body_length =
+            message::Message::ContentLength(
+                std::string_view(connection.input).substr(0, head_length));
+        std::size_t length = head_length;
+
+        // Other requests are handled once their body arrived as well
+        if (body_length && !route && !upload)
+        {
+            if (connection.input.size() - head_length < *body_length)
+                break;
+
+            length += *body_length;
+        }
+
+        // Over the rate limit: answer with the precomposed 503 and close
+        if (!admission_control.AdmitRequest(connection.address))
+        {
+            connection.output.Push(admission_control.GetOverloadResponse());
+            connection.close_after_flush = true;
+            break;
+        }
+
+        trace::Ticks parse_start = trace::Now();
+
+        // Bytes left over were received with this request, not waited for
+        request_trace = tracer.Start(connection.fd);
+        request_trace.Begin(trace::Phase::RECEIVE, connection.input_since);
+        request_trace.End(trace::Phase::RECEIVE, parse_start);
+        request_trace.Begin(trace::Phase::PARSE, parse_start);
+        connection.input_since = 0;
+
+        std::string request = connection.input.substr(0, length);
+        connection.input.erase(0, length);
+        http_message.SetRequest(request);
+
+        request_trace.End(trace::Phase::PARSE);
+
+        // Forwarding a body framed one way to an upstream that reads it
+        // another would smuggle a request past the proxy
+        if (!body_length)
+        {
+            RejectRequest(connection, 400);
+            break;
+        }
+
+        // Bodies are only delimited by `Content-Length': the chunks of a
+        // chunked body would be taken for the next request
+        if (http_message.GetRequestPointer()->GetHeaderLines().contains(
+                "Transfer-Encoding"))
+        {
+            RejectRequest(connection, 411);
+            break;
+        }
+
+        if (route)
+        {
+            StartProxy(connection, *route, request, *body_length);
+            continue;
+        }
+
+        // HTTP/1.1 `Upgrade: h2c', answered on stream 1; never over TLS.
+        // An upload is served over HTTP/1.1, ignoring the upgrade.
+        if (!connection.tls && !upload && IsHttp2Upgrade())
+        {
+            HandleHttp2Upgrade(connection);
+            continue;
+        }
+
+        if (upload)
+        {
+            const auto & request = http_message.GetRequestPointer();
+            const std::vector<std::string> & request_path =
+                request->GetParsedPath();
+
+            Handler & handler = NewHandler(
+                connection,
+                request->GetHeaderLines().at("Connection") == "close" ||
+                    draining);
+            handler.body_left = *body_length;
+
+            // The handler copies what it needs, `http_message' moves on
+            handler.task = UploadFile(
+                connection,
+                path::BelowRoute(request->GetOriginalPath(),
+                                 request_path.empty() ? "" : request_path[0]));
+            handler.task.Start();
+            continue;
+        }
+
+        // Clear the response before setting
+        http_message.GetResponsePointer()->Clear();
+
+        // Set the `Connection' header in response
+        HandleConnectionClose();
+
+        defer_compression = worker_pool.Enabled();
+        this->HandleRequest();
+        defer_compression = false;
+
+        // The response is queued once the workers compressed its body
+        if (deferred_codec != compression::Codec::IDENTITY)
+        {
+            Handler & handler = NewHandler(
+                connection,
+                http_message.GetRequestPointer()->GetHeaderLines().at(
+                    "Connection") == "close" ||
+                    draining);
+
+            // The handler owns the response, `http_message' gets a new one
+            auto reply = std::make_shared<message::Message>();
+            std::swap(reply->GetResponsePointer(),
+                      http_message.GetResponsePointer());
+
+            handler.task = CompressResponse(
+                connection, std::move(reply),
+                std::exchange(deferred_codec, compression::Codec::IDENTITY));
+            handler.task.Start();
+            continue;
+        }
+
+        this->QueueResponse(connection);
+
+        // This connection is not persistent
+        if (http_message.GetRequestPointer()->GetHeaderLines().at(
+                "Connection") == "close" ||
+            draining)
+            connection.close_after_flush = true;
+
+        // A slow reader only costs its queued output
+        if (connection.output.Size() >= HIGH_WATER_MARK)
+            connection.reading_paused = true;
+    }
+
+    return;
+}
+
+void server::Server::QueueResponse(Connection & connection)
+{
+    auto & response = http_message.GetResponsePointer();
+
+    connection.output.Push(response->GetResponse());
+
+    // The file body is sent with `sendfile' behind the head
+    if (response->HasBodyFile())
+    {
+        std::size_t size = response->GetBodyFileSize();
+        connection.output.PushFile(response->TakeBodyFile(), 0, size);
+    }
+
+    // Finished by `FlushConnection()' once the last byte is written
+    request_trace.status = response->GetStatusCode();
+    request_trace.send_end =
+        connection.output.Written() + connection.output.Size();
+    request_trace.Begin(trace::Phase::SEND);
+    connection.sending.push_back(request_trace);
+
+    return;
+}
+
+void server::Server::CloseConnection(int client_fd)
+{
+    // Abandon the request being forwarded, its upstream is in an unknown state
+    auto it = connections.find(client_fd);
+    if (it != connections.end() && it->second.proxy)
+    {
+        int upstream_fd = it->second.proxy->fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, upstream_fd, nullptr);
+        upstream_clients.erase(upstream_fd);
+        close(upstream_fd);
+    }
+
+    if (it != connections.end() && it->second.tls)
+        it->second.tls->Shutdown();
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, nullptr);
+    connections.erase(client_fd);
+
+    // Close the client file descriptor
+    close(client_fd);
+
+    std::cout << "Connection closed\n";
+
+    return;
+}
+
+bool server::Server::ResumeHandler(Connection & connection)
+{
+    Handler & handler = *connection.handler;
+
+    if (handler.waiting_input &&
+        (!connection.input.empty() || connection.peer_closed))
+        std::exchange(handler.waiting_input, nullptr).resume();
+    else if (handler.waiting_output &&
+             connection.output.Size() < LOW_WATER_MARK)
+        std::exchange(handler.waiting_output, nullptr).resume();
+    else if (handler.waiting_job && handler.job_done)
+    {
+        handler.job_done = false;
+        std::exchange(handler.waiting_job, nullptr).resume();
+    }
+
+    if (!handler.task.Done())
+        return false;
+
+    try
+    {
+        handler.task.Result();
+    }
+    catch (const std::exception & e)
+    {
+        std::cerr << e.what() << '\n';
+        handler.close = true;
+    }
+
+    // Unread body bytes would be taken for the next request
+    if (handler.close || handler.body_left > 0)
+        connection.close_after_flush = true;
+
+    handler.request_trace.send_end =
+        connection.output.Written() + connection.output.Size();
+    handler.request_trace.Begin(trace::Phase::SEND);
+    connection.sending.push_back(handler.request_trace);
+
+    connection.handler.reset();
+
+    if (connection.output.Size() >= HIGH_WATER_MARK)
+        connection.reading_paused = true;
+
+    return true;
+}
+
+server::Handler & server::Server::NewHandler(Connection & connection,
+                                             bool         close)
+{
+    Handler & handler     = connection.handler.emplace();
+    handler.id            = next_handler_id++;
+    handler.close         = close;
+    handler.request_trace = request_trace;
+
+    return handler;
+}
+
+void server::Server::WorkerAwaiter::await_suspend(
+    std::coroutine_handle<> awaiting)
+{
+    Handler & handler   = *connection.handler;
+    handler.waiting_job = awaiting;
+
+    server.worker_pool.Submit(
+        priority, std::move(job),
+        [server = &server, client_fd = connection.fd, id = handler.id] {
+            server->FinishWorkerJob(client_fd, id);
+        });
+
+    return;
+}
+
+task::Offload server::Server::FileOffload(Connection &      connection,
+                                         workers::Priority priority)
+{
+    if (!worker_pool.Enabled())
+        return {};
+
+    // Only called from the handler's frame, which the connection outlives
+    return [this, &connection, priority](std::function<void()>   work,
+                                         std::coroutine_handle<> awaiting) {
+        WorkerAwaiter{*this, connection, priority, std::move(work)}
+            .await_suspend(awaiting);
+    };
+}
+
+void server::Server::FinishWorkerJob(int client_fd, std::uint64_t handler_id)
+{
+    // The connection may have closed, or its fd been reused, meanwhile
+    auto it = connections.find(client_fd);
+    if (it == connections.end() || !it->second.handler ||
+        it->second.handler->id != handler_id)
+        return;
+
+    Connection & connection      = it->second;
+    connection.handler->job_done = true;
+
+    if (ResumeHandler(connection))
+        ProcessInput(connection);
+    FlushConnection(connection);
+
+    return;
+}
+
+task::Task<> server::Server::CompressResponse(
+    Connection & connection, std::shared_ptr<message::Message> reply,
+    compression::Codec codec)
+{
+    Handler & handler  = *connection.handler;
+    auto &    response = reply->GetResponsePointer();
+
+    std::size_t body_size = response->HasBodyFile()
+                                ? response->GetBodyFileSize()
+                                : response->GetBody().size();
+    auto        error     = std::make_shared<std::exception_ptr>();
+
+    handler.request_trace.Begin(trace::Phase::COMPRESS);
+
+    // Built outside the `co_await' expression: g++ 12 destroys lambda
+    // temporaries there twice
+    std::function<void()> job = [reply, error, codec,
+                                 &compressor = compressor] {
+        try
+        {
+            compressor.Apply(codec, *reply);
+            reply->GetResponsePointer()->MakeResponse();
+        }
+        catch (const std::exception &)
+        {
+            *error = std::current_exception();
+        }
+    };
+
+    // Bulk bodies leave a worker free for the small ones
+    co_await RunOnWorker(connection,
+                         body_size >= BULK_BODY_SIZE
+                             ? workers::Priority::BULK
+                             : workers::Priority::LATENCY,
+                         std::move(job));
+
+    handler.request_trace.End(trace::Phase::COMPRESS);
+
+    if (*error)
+        std::rethrow_exception(*error);
+
+    handler.request_trace.status = response->GetStatusCode();
+
+    co_await connection.Write(response->GetResponse());
+}
+
+task::Task<> server::Server::UploadFile(Connection & connection,
+                                        std::string  path)
+{
+    Handler & handler = *connection.handler;
+
+    handler.request_trace.Begin(trace::Phase::ROUTE);
+    handler.request_trace.Begin(trace::Phase::FILE_IO);
+
+    // Writes run on a worker, bulk ones if the whole body is large
+    task::File file(path::OpenBeneath(root_fd, path.c_str(),
+                                      O_WRONLY | O_CREAT | O_TRUNC, 0644),
+                    FileOffload(connection, handler.body_left >= BULK_BODY_SIZE
+                                                ? workers::Priority::BULK
+                                                : workers::Priority::LATENCY));
+    bool       written = file.IsOpen();
+
+    if (!file.IsOpen())
+        std::cerr << "fail to write file\n";
+
+    // The body is read to its end even if it cannot be stored
+    for (std::string chunk = co_await connection.ReadBody(); !chunk.empty();
+         chunk             = co_await connection.ReadBody())
+        if (written)
+            written = co_await file.Write(std::move(chunk));
+
+    // The client closed before the whole body arrived: keep no partial file
+    bool truncated = handler.body_left > 0;
+    if (truncated && file.IsOpen())
+        unlinkat(root_fd, path.c_str(), 0);
+
+    handler.request_trace.End(trace::Phase::FILE_IO);
+    handler.request_trace.End(trace::Phase::ROUTE);
+
+    message::Message reply;
+    auto &           response = reply.GetResponsePointer();
+
+    response->SetStatusCode(truncated ? 400 : written ? 201 : 404);
+    if (handler.close || truncated)
+        response->SetHeaderLine("Connection", "close");
+    response->MakeResponse();
+
+    handler.request_trace.status = response->GetStatusCode();
+
+    co_await connection.Write(response->GetResponse());
+}
+
+bool server::Server::AdvanceHandshake(Connection & connection)
+{
+    if (connection.tls->Established())
+        return true;
+
+    switch (connection.tls->Advance())
+    {
+    case tls::Session::Handshake::DONE:
+        break;
+    case tls::Session::Handshake::WANT_IO:
+        UpdateEvents(connection);
+        return false;
+    case tls::Session::Handshake::ERROR:
+        CloseConnection(connection.fd);
+        return false;
+    }
+
+    // HTTP/2 chosen with ALPN starts with the client preface
+    if (connection.tls->Protocol() == "h2")
+    {
+        connection.http2 = MakeHttp2Session(connection);
+        connection.http2->Start();
+        PumpHttp2(connection);
+    }
+
+    UpdateEvents(connection);
+
+    return true;
+}
+
+void server::Server::StartProxy(Connection & connection, proxy::Route & route,
+                                std::string_view head,
+                                std::uint64_t    body_length)
+{
+    const auto & request = http_message.GetRequestPointer();
+    bool         close   = request->GetHeaderLines().at("Connection") ==
+                             "close" ||
+                         draining;
+
+    std::size_t upstream  = proxy_pool.Pick(route);
+    bool        connected = false;
+    bool        reused    = false;
+    int         fd        = upstream == proxy::NO_UPSTREAM
+                                ? -1
+                                : proxy_pool.Acquire(upstream, connected,
+                                                     reused);
+
+    if (fd < 0)
+    {
+        std::cerr << "No upstream for " << request->GetOriginalPath() << '\n';
+        FailProxy(connection, 502);
+        return;
+    }
+
+    connection.proxy = std::make_unique<proxy::Exchange>(
+        upstream, fd, connected,
+        proxy::ResponseReader(request->GetHttpMethod() == "HEAD", close));
+
+    proxy::Exchange & exchange = *connection.proxy;
+    exchange.to_upstream = proxy::RewriteRequestHead(head, connection.address);
+    exchange.body_left   = body_length;
+
+    // The upstream may have closed a pooled connection just as we took it.
+    // Only a request without a body is kept to be sent again, and only if
+    // sending it twice is harmless (RFC 9110 §9.2.2)
+    const std::string & method = request->GetHttpMethod();
+    if (reused && body_length == 0 &&
+        (method == "GET" || method == "HEAD" || method == "OPTIONS" ||
+         method == "TRACE" || method == "PUT" || method == "DELETE"))
+        exchange.retry = exchange.to_upstream;
+
+    exchange.request_trace = request_trace;
+    exchange.request_trace.Begin(trace::Phase::ROUTE);
+
+    epoll_event event;
+    event.events  = exchange.events = EPOLLIN | EPOLLOUT;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    upstream_clients[fd] = connection.fd;
+
+    if (!PumpRequestBody(connection) && !RetryProxy(connection))
+        FailProxy(connection, 502);
+
+    return;
+}
+
+bool server::Server::PumpRequestBody(Connection & connection)
+{
+    proxy::Exchange & exchange = *connection.proxy;
+
+    while (true)
+    {
+        // Hold at most a high-water mark of body for a slow upstream
+        std::size_t room =
+            HIGH_WATER_MARK -
+            std::min<std::size_t>(exchange.to_upstream.size(), HIGH_WATER_MARK);
+        std::size_t taken = std::min<std::uint64_t>(
+            {exchange.body_left, connection.input.size(), room});
+
+        exchange.to_upstream.append(connection.input, 0, taken);
+        connection.input.erase(0, taken);
+        exchange.body_left -= taken;
+
+        if (!exchange.connected || exchange.to_upstream.empty())
+            break;
+
+        ssize_t sent =
+            send(exchange.fd, exchange.to_upstream.data(),
+                 exchange.to_upstream.size(), MSG_NOSIGNAL);
+
+        if (sent > 0)
+        {
+            exchange.to_upstream.erase(0, sent);
+            continue;
+        }
+
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        return false;
+    }
+
+    // Stop reading the client while the upstream is behind
+    connection.reading_paused =
+        exchange.body_left > 0 && !connection.input.empty();
+
+    UpdateEvents(connection);
+    UpdateUpstreamEvents(connection);
+
+    return true;
+}
+
+bool server::Server::RetryProxy(Connection & connection)
+{
+    proxy::Exchange & exchange = *connection.proxy;
+
+    if (exchange.retry.empty())
+        return false;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, exchange.fd, nullptr);
+    upstream_clients.erase(exchange.fd);
+    close(exchange.fd);
+
+    bool connected = false;
+    int  fd        = proxy_pool.Connect(exchange.upstream, connected);
+
+    // Nothing is left to close in `FailProxy()'
+    exchange.fd = -1;
+    if (fd < 0)
+        return false;
+
+    exchange.fd          = fd;
+    exchange.connected   = connected;
+    exchange.to_upstream = std::move(exchange.retry);
+    exchange.retry.clear();
+
+    epoll_event event;
+    event.events  = exchange.events = EPOLLIN | EPOLLOUT;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    upstream_clients[fd] = connection.fd;
+
+    return PumpRequestBody(connection);
+}
+
+void server::Server::ReadUpstream(Connection & connection)
+{
+    proxy::Exchange & exchange = *connection.proxy;
+    char              buffer[BUFFER_LENGTH];
+    std::string       relay;
+    std::size_t       received  = 0;
+    bool              closed    = false;
+    bool              malformed = false;
+
+    // Bound the work per wakeup like `HandleReadable()'
+    while (received < HIGH_WATER_MARK && !exchange.reader.Done())
+    {
+        ssize_t receive_bytes = recv(exchange.fd, buffer, sizeof(buffer), 0);
+
+        if (receive_bytes > 0)
+        {
+            received += receive_bytes;
+            exchange.retry.clear();
+
+            if (!exchange.reader.Feed(
+                    std::string_view(buffer, receive_bytes), relay))
+            {
+                malformed = true;
+                break;
+            }
+            continue;
+        }
+
+        if (receive_bytes < 0 && errno == EINTR)
+            continue;
+        if (receive_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        closed = true;
+        break;
+    }
+
+    // A pooled connection closed without an answer
+    if (closed && received == 0 && RetryProxy(connection))
+        return;
+
+    connection.output.Push(std::move(relay));
+
+    if (malformed || (closed && !exchange.reader.FeedClose()))
+    {
+        std::cerr << "Bad response from upstream "
+                  << proxy_pool.Name(exchange.upstream) << '\n';
+        FailProxy(connection, 502);
+        return;
+    }
+
+    if (exchange.reader.Done())
+    {
+        FinishProxy(connection);
+        return;
+    }
+
+    // A slow client only costs its queued output, as for local responses
+    if (connection.output.Size() >= HIGH_WATER_MARK)
+    {
+        exchange.reading_paused = true;
+        UpdateUpstreamEvents(connection);
+    }
+
+    return;
+}
+
+void server::Server::HandleUpstream(Connection & connection,
+                                    std::uint32_t events)
+{
+    proxy::Exchange & exchange = *connection.proxy;
+
+    if (!exchange.connected)
+    {
+        int       error  = 0;
+        socklen_t length = sizeof(error);
+
+        getsockopt(exchange.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+
+        if (error != 0)
+        {
+            proxy_pool.MarkDown(exchange.upstream);
+            FailProxy(connection, 502);
+            FlushConnection(connection);
+            return;
+        }
+
+        exchange.connected = true;
+    }
+
+    if ((events & EPOLLOUT) && !PumpRequestBody(connection))
+    {
+        if (!RetryProxy(connection))
+            FailProxy(connection, 502);
+    }
+    else if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        ReadUpstream(connection);
+
+    FlushConnection(connection);
+
+    return;
+}
+
+void server::Server::UpdateUpstreamEvents(Connection & connection)
+{
+    proxy::Exchange & exchange = *connection.proxy;
+    std::uint32_t     events   = 0;
+
+    if (!exchange.reading_paused)
+        events |= EPOLLIN;
+    if (!exchange.connected || !exchange.to_upstream.empty())
+        events |= EPOLLOUT;
+
+    if (events == exchange.events)
+        return;
+
+    epoll_event event;
+    event.events  = exchange.events = events;
+    event.data.fd = exchange.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, exchange.fd, &event);
+
+    return;
+}
+
+void server::Server::FinishProxy(Connection & connection)
+{
+    std::unique_ptr<proxy::Exchange> exchange = std::move(connection.proxy);
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, exchange->fd, nullptr);
+    upstream_clients.erase(exchange->fd);
+
+    // Reuse the connection only if the whole request went out
+    if (exchange->reader.KeepAlive() && exchange->body_left == 0 &&
+        exchange->to_upstream.empty())
+        proxy_pool.Release(exchange->upstream, exchange->fd);
+    else
+        close(exchange->fd);
+
+    // The rest of an unsent body cannot be told apart from the next request
+    if (exchange->reader.ClosesClient() || exchange->body_left > 0)
+        connection.close_after_flush = true;
+
+    // Finished by `FlushConnection()' like a local response
+    trace::RequestTrace & relayed = exchange->request_trace;
+    relayed.End(trace::Phase::ROUTE);
+    relayed.status = exchange->reader.GetStatusCode();
+    relayed.send_end = connection.output.Written() + connection.output.Size();
+    relayed.Begin(trace::Phase::SEND);
+    connection.sending.push_back(relayed);
+
+    connection.reading_paused = false;
+    ProcessInput(connection);
+
+    return;
+}
+
+void server::Server::FailProxy(Connection & connection, int status)
+{
+    bool started = false;
+
+    if (connection.proxy)
+    {
+        int upstream_fd = connection.proxy->fd;
+
+        if (upstream_fd >= 0)
+        {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, upstream_fd, nullptr);
+            upstream_clients.erase(upstream_fd);
+            close(upstream_fd);
+        }
+
+        started       = connection.proxy->reader.Started();
+        request_trace = connection.proxy->request_trace;
+        request_trace.End(trace::Phase::ROUTE);
+        connection.proxy.reset();
+    }
+
+    // A partly relayed response can only be cut short
+    if (!started)
+        RejectRequest(connection, status);
+
+    connection.close_after_flush = true;
+
+    return;
+}
+
+void server::Server::RejectRequest(Connection & connection, int status)
+{
+    auto & response = http_message.GetResponsePointer();
+
+    response->Clear();
+    response->SetStatusCode(status);
+    response->SetHeaderLine("Connection", "close");
+    response->MakeResponse();
+    QueueResponse(connection);
+
+    connection.close_after_flush = true;
+
+    return;
+}
+
+/**
+ *@brief Turn the response of the HTTP/1.1 handlers into an HTTP/2 one
+ */
+static http2::Session::Response http2Response(message::Message & message)
+{
+    auto &                   reply = message.GetResponsePointer();
+    http2::Session::Response response;
+
+    response.status = reply->GetStatusCode();
+
+    // A file body is read by the session as its frames go out
+    if (reply->HasBodyFile())
+    {
+        response.body_file_size = reply->GetBodyFileSize();
+        response.body_file      = reply->TakeBodyFile();
+    }
+    else
+        response.body = reply->GetBody();
+
+    for (const auto & [key, value] : reply->GetHeaderLines())
+    {
+        std::string name = key;
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+        if (name != "connection")
+            response.headers.emplace_back(std::move(name), value);
+    }
+
+    return response;
+}
+
+std::unique_ptr<http2::Session>
+server::Server::MakeHttp2Session(const Connection & connection)
+{
+    return std::make_unique<http2::Session>(
+        [this, fd = connection.fd, id = connection.id,
+         address = connection.address](std::uint32_t stream_id,
+                                        const std::vector<http2::Header> & headers,
+                                        const std::string & body) {
+            if (!admission_control.AdmitRequest(address))
+                return http2::Session::Response{
+                    503,
+                    {{"retry-after",
+                      std::to_string(admission_control.GetRetryAfter())}},
+                    {}};
+
+            return HandleHttp2Request(stream_id, headers, body, fd, id);
+        },
+        MAX_REQUEST_LENGTH);
+}
+
+void server::Server::PumpHttp2(Connection & connection)
+{
+    std::size_t queued = connection.output.Size();
+
+    connection.output.Push(connection.http2->TakeOutput(
+        queued < HIGH_WATER_MARK ? HIGH_WATER_MARK - queued : 0));
+
+    if (connection.http2->IsClosed())
+        connection.close_after_flush = true;
+
+    return;
+}
+
+std::size_t server::Server::AcceptQueueDepth() const
+{
+    std::size_t depth = 0;
+
+    // Both ports are served by the same loop
+    for (int listen_fd : {server_fd, tls_fd})
+    {
+        tcp_info  info;
+        socklen_t length = sizeof(info);
+
+        // For a listening socket `tcpi_unacked' is the accept queue length
+        if (listen_fd >= 0 &&
+            getsockopt(listen_fd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0)
+            depth += info.tcpi_unacked;
+    }
+
+    return depth;
+}
+
+void server::Server::SetResponse()
+{
+    const std::vector<std::string> & request_path =
+        http_message.GetRequestPointer()->GetParsedPath();
+
+    // Only HTTP/1.1 connections are forwarded, see `StartProxy()'
+    if (!proxy_pool.Empty() &&
+        proxy_pool.Match(http_message.GetRequestPointer()->GetOriginalPath()))
+        http_message.GetResponsePointer()->SetStatusCode(502);
+    else if (request_path.at(0) == "echo")
+        HandleEcho(request_path);
+    else if (request_path.at(0) == "user-agent")
+        HandleUserAgent();
+    else if (request_path.at(0) == "files")
+        HandleFile(request_path);
+    else
+        HandleDefault();
+
+    HandleCompression();
+
+    // Otherwise made once the workers compressed the body
+    if (deferred_codec == compression::Codec::IDENTITY)
+        http_message.GetResponsePointer()->MakeResponse();
+
+    return;
+}
+
+void server::Server::HandleEcho(const std::vector<std::string> & request_path)
+{
+    try
+    {
+        http_message.GetResponsePointer()->SetBody(request_path.at(1));
+    }
+    catch (const std::out_of_range & e)
+    {
+        std::cout << e.what() << '\n';
+    }
+
+    http_message.GetResponsePointer()->SetHeaderLine("Content-Type",
+                                                     "text/plain");
+
+    return;
+}
+
+void server::Server::HandleUserAgent()
+{
+    http_message.GetResponsePointer()->SetBody(
+        http_message.GetRequestPointer()->GetHeaderLines("User-Agent"));
+
+    http_message.GetResponsePointer()->SetHeaderLine("Content-Type",
+                                                     "text/plain");
+
+    return;
+}
+
+void server::Server::HandleFile(const std::vector<std::string> & request_path)
+{
+    request_trace.Begin(trace::Phase::FILE_IO);
+
+    // Open the file, resolved beneath the root directory
+    int file_fd = path::OpenBeneath(
+        root_fd,
+        path::BelowRoute(http_message.GetRequestPointer()->GetOriginalPath(),
+                         request_path.at(0)),
+        O_RDONLY);
+    struct stat file_stat;
+    bool        regular = file_fd >= 0 && fstat(file_fd, &file_stat) == 0 &&
+                   S_ISREG(file_stat.st_mode);
+
+    request_trace.End(trace::Phase::FILE_IO);
+
+    // If the file does not exist or is not a regular file
+    if (!regular)
+    {
+        if (file_fd >= 0)
+            close(file_fd);
+
+        http_message.GetResponsePointer()->SetStatusCode(404);
+        return;
+    }
+
+    http_message.GetResponsePointer()->SetStatusCode(200);
+    http_message.GetResponsePointer()->SetHeaderLine(
+        "Content-Type", "application/octet-stream");
+
+    // The file is sent with `sendfile' unless it gets compressed
+    http_message.GetResponsePointer()->SetBodyFile(file_fd, file_stat.st_size);
+
+    return;
+}
+
+void server::Server::HandleDefault()
+{
+    int fd = path::OpenBeneath(
+        root_fd,
+        path::BelowRoute(http_message.GetRequestPointer()->GetOriginalPath(), ""),
+        O_PATH);
+
+    http_message.GetResponsePointer()->SetStatusCode(fd >= 0 ? 200 : 404);
+
+    if (fd >= 0)
+        close(fd);
+
+    return;
+}
+
+void server::Server::HandleRequest()
+{
+    request_trace.Begin(trace::Phase::ROUTE);
+
+    // If the method is POST
+    if (http_message.GetRequestPointer()->GetHttpMethod() == "POST")
+        this->HandlePOSTMethod(
+            http_message.GetRequestPointer()->GetParsedPath());
+    else /* By default, handle GET method */
+        this->HandleGETMethod();
+
+    request_trace.End(trace::Phase::ROUTE);
+
+    return;
+}
+
+void server::Server::HandleGETMethod()
+{
+    this->SetResponse();
+}
+
+void server::Server::HandlePOSTMethod(
+    const std::vector<std::string> & request_path)
+{
+    const std::string & body = http_message.GetRequestPointer()->GetBody();
+    int                 file_fd;
+
+    request_trace.Begin(trace::Phase::FILE_IO);
+
+    try
+    {
+        file_fd = path::OpenBeneath(
+            root_fd,
+            path::BelowRoute(http_message.GetRequestPointer()->GetOriginalPath(),
+                             request_path.at(0)),
+            O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        // Fail to open the file
+        if (file_fd < 0)
+            throw server::ServerException("fail to write file");
+    }
+    catch (const server::ServerException & e)
+    {
+        std::cerr << e.what() << '\n';
+
+        request_trace.End(trace::Phase::FILE_IO);
+        http_message.GetResponsePointer()->SetStatusCode(404);
+        http_message.GetResponsePointer()->MakeResponse();
+        return;
+    }
+
+    // Write the file and close the file
+    for (std::size_t written = 0; written < body.size();)
+    {
+        ssize_t n =
+            write(file_fd, body.data() + written, body.size() - written);
+
+        if (n < 0 && errno != EINTR)
+            break;
+        written += std::max<ssize_t>(n, 0);
+    }
+    close(file_fd);
+
+    request_trace.End(trace::Phase::FILE_IO);
+
+    // Set the response
+    http_message.GetResponsePointer()->SetStatusCode(201);
+
+    // Make the response
+    http_message.GetResponsePointer()->MakeResponse();
+
+    return;
+}
+
+void server::Server::HandleCompression()
+{
+    const auto & request  = http_message.GetRequestPointer();
+    auto &       response = http_message.GetResponsePointer();
+
+    // Nothing to negotiate
+    if (!request->GetHeaderLines().contains("Accept-Encoding"))
+        return;
+
+    std::size_t body_size = response->HasBodyFile()
+                                ? response->GetBodyFileSize()
+                                : response->GetBody().size();
+    std::optional<compression::Codec> negotiated =
+        compressor.Negotiate(request->GetCompressionOptions(), body_size);
+
+    response->SetHeaderLine("Vary", "Accept-Encoding");
+
+    // Every coding the body could be sent in is refused
+    if (!negotiated)
+    {
+        if (body_size > 0)
+        {
+            response->ClearBody();
+            response->SetStatusCode(406);
+        }
+        return;
+    }
+
+    compression::Codec codec = *negotiated;
+
+    if (codec == compression::Codec::IDENTITY)
+        return;
+
+    // Large bodies are compressed off the event loop
+    if (defer_compression && body_size >= OFFLOAD_BODY_SIZE)
+    {
+        deferred_codec = codec;
+        return;
+    }
+
+    // Compress the body
+    request_trace.Begin(trace::Phase::COMPRESS);
+    compressor.Apply(codec, http_message);
+    request_trace.End(trace::Phase::COMPRESS);
+
+    return;
+}
+
+bool server::Server::SetRootDirectory(const std::string & directory)
+{
+    int fd = open(directory.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0)
+        return false;
+
+    if (root_fd != AT_FDCWD)
+        close(root_fd);
+    root_fd = fd;
+
+    return true;
+}
+
+bool server::Server::ConfigureCompression(const std::string & spec)
+{
+    return compressor.Configure(spec);
+}
+
+bool server::Server::ConfigureAdmission(const std::string & option,
+                                        const std::string & value)
+{
+    if (option == "--backlog")
+    {
+        try
+        {
+            std::size_t end;
+            int         backlog = std::stoi(value, &end);
+
+            if (end != value.size() || backlog <= 0)
+                return false;
+
+            connection_backlog = backlog;
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    return admission_control.Configure(option, value);
+}
+
+bool server::Server::ConfigureTracing(const std::string & option,
+                                      const std::string & value)
+{
+    return tracer.Configure(option, value);
+}
+
+bool server::Server::ConfigureWorkers(const std::string & option,
+                                      const std::string & value)
+{
+    return worker_pool.Configure(option, value);
+}
+
+bool server::Server::ConfigureProxy(const std::string & spec)
+{
+    return proxy_pool.Configure(spec);
+}
+
+bool server::Server::ConfigureTls(const std::string & option,
+                                  const std::string & value)
+{
+    return tls_context.Configure(option, value);
+}
+
+bool server::Server::IsHttp2Upgrade() const
+{
+    const auto & request = http_message.GetRequestPointer();
+
+    return request->GetHeaderLines("Upgrade") == "h2c" &&
+           request->GetHeaderLines().contains("HTTP2-Settings");
+}
+
+void server::Server::HandleHttp2Upgrade(Connection & connection)
+{
+    const auto & request = http_message.GetRequestPointer();
+
+    // Rebuild the upgrade request as the header list of stream 1
+    std::vector<http2::Header> headers = {
+        {":method", request->GetHttpMethod()},
+        {":scheme", "http"},
+        {":path", request->GetOriginalPath()},
+        {":authority", request->GetHeaderLines("Host")},
+    };
+
+    for (const auto & [key, value] : request->GetHeaderLines())
+    {
+        std::string name = key;
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+        // Connection-specific headers do not exist in HTTP/2
+        if (name != "host" && name != "connection" && name != "upgrade" &&
+            name != "http2-settings" && name != "keep-alive")
+            headers.emplace_back(std::move(name), value);
+    }
+
+    std::string settings = request->GetHeaderLines("HTTP2-Settings");
+    std::string body     = request->GetBody();
+
+    connection.output.Push("HTTP/1.1 101 Switching Protocols\r\n"
+                           "Connection: Upgrade\r\n"
+                           "Upgrade: h2c\r\n\r\n");
+
+    connection.http2 = MakeHttp2Session(connection);
+    connection.http2->StartUpgraded(settings, headers, body);
+    PumpHttp2(connection);
+
+    return;
+}
+
+http2::Session::Response
+server::Server::HandleHttp2Request(std::uint32_t stream_id,
+                                   const std::vector<http2::Header> & headers,
+                                   const std::string & body, int client_fd,
+                                   std::uint64_t connection_id)
+{
+    std::string method, path, header_lines;
+
+    // Turn the stream into an HTTP/1.1 request for the existing handlers
+    for (const auto & [name, value] : headers)
+    {
+        if (name == ":method")
+            method = value;
+        else if (name == ":path")
+            path = value;
+        else if (name == ":authority")
+            header_lines.append("Host: " + value + "\r\n");
+        else if (!name.starts_with(":"))
+            header_lines.append(name + ": " + value + "\r\n");
+    }
+
+    // The frames were received and decoded by the session
+    request_trace = tracer.Start(client_fd);
+    request_trace.Begin(trace::Phase::PARSE);
+
+    http_message.SetRequest(method + " " + path + " HTTP/1.1\r\n" +
+                            header_lines + "\r\n" + body);
+    http_message.GetResponsePointer()->Clear();
+
+    request_trace.End(trace::Phase::PARSE);
+
+    defer_compression = worker_pool.Enabled();
+    this->HandleRequest();
+    defer_compression = false;
+
+    // The session sends the response once the workers compressed its body
+    if (deferred_codec != compression::Codec::IDENTITY)
+    {
+        auto reply = std::make_shared<message::Message>();
+        std::swap(reply->GetResponsePointer(),
+                  http_message.GetResponsePointer());
+
+        CompressHttp2Response(
+            client_fd, connection_id, stream_id, std::move(reply),
+            std::exchange(deferred_codec, compression::Codec::IDENTITY));
+
+        http2::Session::Response deferred;
+        deferred.deferred = true;
+
+        return deferred;
+    }
+
+    http2::Session::Response response = http2Response(http_message);
+
+    // The session interleaves the streams, their sending is not traced
+    request_trace.status = response.status;
+    tracer.Finish(request_trace);
+
+    return response;
+}
+
+void server::Server::CompressHttp2Response(
+    int client_fd, std::uint64_t connection_id, std::uint32_t stream_id,
+    std::shared_ptr<message::Message> reply, compression::Codec codec)
+{
+    std::size_t body_size =
+        reply->GetResponsePointer()->HasBodyFile()
+            ? reply->GetResponsePointer()->GetBodyFileSize()
+            : reply->GetResponsePointer()->GetBody().size();
+
+    request_trace.Begin(trace::Phase::COMPRESS);
+
+    worker_pool.Submit(
+        body_size >= BULK_BODY_SIZE ? workers::Priority::BULK
+                                    : workers::Priority::LATENCY,
+        [reply, codec, &compressor = compressor] {
+            compressor.Apply(codec, *reply);
+        },
+        [this, client_fd, connection_id, stream_id, reply,
+         compress_trace = request_trace]() mutable {
+            compress_trace.End(trace::Phase::COMPRESS);
+
+            http2::Session::Response response = http2Response(*reply);
+
+            compress_trace.status = response.status;
+            tracer.Finish(compress_trace);
+
+            // The connection may have closed, or its fd been reused,
+            // meanwhile; the session drops the response of a reset stream
+            auto it = connections.find(client_fd);
+            if (it == connections.end() || it->second.id != connection_id ||
+                !it->second.http2)
+            {
+                if (response.body_file >= 0)
+                    close(response.body_file);
+                return;
+            }
+
+            Connection & connection = it->second;
+            connection.http2->Complete(stream_id, std::move(response));
+
+            PumpHttp2(connection);
+            FlushConnection(connection);
+        });
+
+    return;
 }
 
 void server::Server::HandleConnectionClose()
 {
     /**
      * If the `Connection' header is `close',
-     * then set the `Connection' header to `close' in response as well
+     * then set the `Connection' header to `close' in response as well.
+     * While draining, the connection is closed after this response.
      */
     if (http_message.GetRequestPointer()->GetHeaderLines().at("Connection") ==
-        "close")
+            "close" ||
+        draining)
         http_message.GetResponsePointer()->SetHeaderLine("Connection", "close");
 
     return;
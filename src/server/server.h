@@ -2,27 +2,323 @@
 #define _SERVER_H_
 
 #include "../http/message.h"
+#include "../http2/session.h"
+#include "admission.h"
+#include "compression.h"
+#include "connection.h"
+#include "proxy.h"
+#include "task.h"
+#include "tls.h"
+#include "trace.h"
+#include "workers.h"
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <fcntl.h>
 #include <exception>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
-
-#define BEGIN_SERVER_NAMESPACE \
-    namespace server           \
-    {
-#define END_SERVER_NAMESPACE }
+#include <unordered_map>
 
 BEGIN_SERVER_NAMESPACE
 
 class Server
 {
 private:
-    enum { BUFFER_LENGTH = 1024 };
+    enum { BUFFER_LENGTH = 16384 };
+
+    // Smaller bodies are compressed on the event loop, larger ones by the
+    // workers, as bulk jobs from `BULK_BODY_SIZE' up
+    enum { OFFLOAD_BODY_SIZE = 16 * 1024, BULK_BODY_SIZE = 256 * 1024 };
+
+    // Unparsed input beyond this closes the connection
+    enum { MAX_REQUEST_LENGTH = 16 * 1024 * 1024 };
+
+    // How long a closing connection waits for the client to close
+    static constexpr auto LINGER_TIMEOUT = std::chrono::seconds(2);
 
     const int PORT = 4221;
 
-    int              server_fd;
-    message::Message http_message;
+    // The maximum number of connections waiting to be accepted
+    int connection_backlog = 500;
+
+    int                         server_fd  = -1;
+    int                         upgrade_fd = -1; /* Unix socket for upgrades */
+    int                         epoll_fd   = -1;
+    int                         root_fd    = AT_FDCWD; /* `--directory' */
+    int                         tls_fd     = -1;       /* TLS port */
+    tls::Context                tls_context;
+    message::Message            http_message;
+    compression::Compressor     compressor;
+    admission::AdmissionControl admission_control;
+    trace::Tracer               tracer;
+    trace::RequestTrace         request_trace; /* The request being served */
+    proxy::Pool                 proxy_pool;
+    workers::ThreadPool         worker_pool; /* Stopped before `compressor' */
+
+    // The current request may wait for the workers to compress its body
+    bool defer_compression = false;
+    // Set by `HandleCompression()' when it left the body to the workers
+    compression::Codec deferred_codec = compression::Codec::IDENTITY;
+
+    std::uint64_t next_handler_id    = 1;
+    std::uint64_t next_connection_id = 1;
+
+    // The client connection of each upstream socket in use
+    std::unordered_map<int, int> upstream_clients;
+
+    bool accepting = true;
+    bool draining  = false;
+
+    // Open connections by file descriptor, all owned by the event loop
+    std::unordered_map<int, Connection> connections;
+
+    struct Lingering
+    {
+        std::chrono::steady_clock::time_point until;
+        int                                   fd;
+        std::uint64_t                         id;
+    };
+
+    // Lingering connections in the order they close at the latest
+    std::deque<Lingering> lingering;
+
+    /**
+     *@brief Hand the listening socket to a new process and stop accepting
+     */
+    void HandOffSocket();
+
+    /**
+     *@brief Stop accepting and close the idle keep-alive connections; busy
+     * ones close after their current response
+     */
+    void StartDrain();
+
+    /**
+     *@brief Register the epoll events the connection currently needs:
+     * readable unless its reads are paused, writable while output is queued
+     */
+    void UpdateEvents(Connection & connection);
+
+    /**
+     *@brief Read what the client sent and serve the complete requests
+     */
+    void HandleReadable(Connection & connection);
+
+    /**
+     *@brief Write queued output, resuming reads below the low-water mark
+     *
+     * @return false the connection was closed, or lingers until it closes
+     */
+    bool FlushConnection(Connection & connection);
+
+    /**
+     *@brief Close a connection whose client may still be sending
+     *
+     * Closing a socket with unread input sends a RST, which can discard
+     * the last response before the client reads it. The write side is
+     * shut instead, and input is discarded until the client closes or
+     * `LINGER_TIMEOUT' passes.
+     */
+    void LingerConnection(Connection & connection);
+
+    /**
+     *@brief Discard what a lingering connection received, closing it once
+     * the client has closed
+     */
+    void DiscardInput(Connection & connection);
+
+    /**
+     *@brief Close the lingering connections whose time is up
+     */
+    void ExpireLingering(std::chrono::steady_clock::time_point now);
+
+    /**
+     *@brief Serve the complete requests buffered on a connection until its
+     * output passes the high-water mark
+     */
+    void ProcessInput(Connection & connection);
+
+    /**
+     *@brief Queue the current response on the connection
+     */
+    void QueueResponse(Connection & connection);
+
+    void CloseConnection(int client_fd);
+
+    /**
+     *@brief Resume the handler of a connection if what it awaits is there,
+     * and queue its response once it finished
+     *
+     * @return true the handler finished, the connection serves the next
+     * request
+     */
+    bool ResumeHandler(Connection & connection);
+
+    /**
+     *@brief Give the connection a handler for the current request
+     *
+     * @param connection the client connection
+     * @param close whether the connection closes after the response
+     */
+    Handler & NewHandler(Connection & connection, bool close);
+
+    /**
+     *@brief Awaitable running a job on the worker pool; the handler resumes
+     * on the event loop once it is done
+     */
+    struct WorkerAwaiter
+    {
+        Server &              server;
+        Connection &          connection;
+        workers::Priority     priority;
+        std::function<void()> job;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> awaiting);
+        void await_resume() const noexcept {}
+    };
+
+    /**
+     *@brief Run a job on a worker from a handler
+     *
+     * @param connection the client connection, whose handler awaits
+     * @param priority the priority of the job
+     * @param job the work, owning everything it touches since the
+     * connection may close meanwhile
+     */
+    WorkerAwaiter RunOnWorker(Connection & connection,
+                              workers::Priority priority,
+                              std::function<void()> job)
+    {
+        return {*this, connection, priority, std::move(job)};
+    }
+
+    /**
+     *@brief Where a handler's file reads and writes run
+     *
+     * @param connection the client connection, whose handler owns the file
+     * @param priority the priority of the jobs
+     * @return task::Offload the worker pool, none when it is disabled
+     */
+    task::Offload FileOffload(Connection & connection,
+                              workers::Priority priority);
+
+    /**
+     *@brief A worker job of a handler is done, resume it if the connection
+     * is still there
+     */
+    void FinishWorkerJob(int client_fd, std::uint64_t handler_id);
+
+    /**
+     *@brief Compress a response body on the worker pool and queue it
+     *
+     * @param connection the client connection, whose handler this is
+     * @param reply the response, whose body is still uncompressed
+     * @param codec the codec chosen by `HandleCompression()'
+     */
+    task::Task<> CompressResponse(Connection &                      connection,
+                                  std::shared_ptr<message::Message> reply,
+                                  compression::Codec                codec);
+
+    /**
+     *@brief Stream an HTTP/1.1 request body into a file as it arrives
+     *
+     * @param connection the client connection, whose handler this is
+     * @param path the file path relative to the root directory
+     */
+    task::Task<> UploadFile(Connection & connection, std::string path);
+
+    /**
+     *@brief Advance the TLS handshake of a connection
+     *
+     * @return true the handshake is done and the connection can be served
+     */
+    bool AdvanceHandshake(Connection & connection);
+
+    /**
+     *@brief Forward the current request to an upstream of the route
+     *
+     * @param connection the client connection
+     * @param route the matching proxy route
+     * @param head the request line and headers as received
+     * @param body_length the `Content-Length' of the request
+     */
+    void StartProxy(Connection & connection, proxy::Route & route,
+                    std::string_view head, std::uint64_t body_length);
+
+    /**
+     *@brief Move the received request body towards the upstream and write
+     * as much as the upstream accepts
+     *
+     * @return false the upstream connection is broken
+     */
+    bool PumpRequestBody(Connection & connection);
+
+    /**
+     *@brief Send the request again on a new upstream connection, once, when
+     * a pooled connection died before the upstream answered
+     *
+     * @return false the request cannot be retried or the retry failed
+     */
+    bool RetryProxy(Connection & connection);
+
+    /**
+     *@brief Relay what the upstream sent to the client
+     */
+    void ReadUpstream(Connection & connection);
+
+    /**
+     *@brief Handle the epoll events of the upstream socket of a connection
+     */
+    void HandleUpstream(Connection & connection, std::uint32_t events);
+
+    /**
+     *@brief Register the epoll events the upstream socket currently needs
+     */
+    void UpdateUpstreamEvents(Connection & connection);
+
+    /**
+     *@brief The response was relayed: pool the upstream connection and
+     * serve the requests pipelined behind
+     */
+    void FinishProxy(Connection & connection);
+
+    /**
+     *@brief Give up on the forwarded request, answering `status' if nothing
+     * was relayed yet, and close the client connection
+     */
+    void FailProxy(Connection & connection, int status);
+
+    /**
+     *@brief Answer `status' to the request just parsed and close the
+     * connection once it is written
+     */
+    void RejectRequest(Connection & connection, int status);
+
+    /**
+     *@brief Create an HTTP/2 session served by the HTTP/1.1 handlers
+     *
+     * @param connection the client connection, its address rate limits the
+     * streams
+     */
+    std::unique_ptr<http2::Session>
+    MakeHttp2Session(const Connection & connection);
+
+    /**
+     *@brief Queue the output of the HTTP/2 session of a connection, framing
+     * response bodies up to the high-water mark
+     */
+    void PumpHttp2(Connection & connection);
+
+    /**
+     *@brief Get the number of connections waiting in the accept queues of
+     * both listening sockets
+     */
+    std::size_t AcceptQueueDepth() const;
 
 public:
     Server(int port) : PORT(port) {}
@@ -41,34 +337,56 @@ public:
     void Listen();
 
     /**
-     *@brief Accept the connection from client
+     *@brief Route SIGTERM and SIGINT to the accept loop so that it stops
+     * accepting and the server can drain
+     */
+    void InstallSignalHandlers();
+
+    /**
+     *@brief Receive the listening socket from a running server
      *
-     * @return int client_fd
+     * @param path the Unix socket path the running server listens on
+     * @return true the socket was inherited, no need to bind the port
+     * @return false there is no running server to take over from
      */
-    int AcceptClient();
+    bool InheritSocket(const std::string & path);
 
     /**
-     *@brief Receive data from client
+     *@brief Listen on a Unix socket for a new process asking to take over
+     * the listening socket
      *
-     * @param client_fd the client
-     * @return std::string the data received from client
+     * @param path the Unix socket path
      */
-    std::string Receive(int client_fd);
+    void ListenForUpgrade(const std::string & path);
 
     /**
-     * @brief Send message to the client
+     *@brief Listen on the TLS port if a certificate was configured, unless
+     * the socket was inherited
+     */
+    void ListenTls();
+
+    /**
+     *@brief Accept the connection from client
      *
-     * @param client_fd the client
-     * @param message the message to be sent
+     * Connections over the admission limits are answered with a 503 and
+     * closed right away.
+     *
+     * @param listen_fd the plaintext or the TLS listening socket
+     * @return int client_fd, or -1 if nothing was accepted
      */
-    void Send(int client_fd, const std::string & message);
+    int AcceptClient(int listen_fd);
 
     /**
-     *@brief Handle the client
+     *@brief Run the event loop until the server has drained
+     *
+     * All connections are served from this thread with non-blocking
+     * sockets. After SIGTERM or a hot upgrade the loop stops accepting and
+     * exits once in-flight requests are answered.
      *
-     * @param client_fd the client file description
+     * @param drain_timeout how long to wait for in-flight requests before
+     * cutting the remaining connections
      */
-    void HandleClient(int client_fd);
+    void Run(std::chrono::milliseconds drain_timeout);
 
     /**
      *@brief Set the response
@@ -97,34 +415,141 @@ public:
      */
     void HandleDefault();
 
+    /**
+     *@brief Set the response for the current request by its http method
+     */
+    void HandleRequest();
+
     /**
      *@brief Handle the GET http method
-     *
-     * @param client_fd the client file description
      */
-    void HandleGETMethod(int client_fd);
+    void HandleGETMethod();
 
     /**
-     *@brief Handle the POST http method
+     *@brief Handle the POST http method of an HTTP/2 stream, whose body is
+     * complete; HTTP/1.1 uploads stream through `UploadFile()'
      *
-     * @param client_fd the client file description
      * @param request_path the parsed request path
      */
-    void HandlePOSTMethod(int                              client_fd,
-                          const std::vector<std::string> & request_path);
+    void HandlePOSTMethod(const std::vector<std::string> & request_path);
+
+    /**
+     *@brief Whether the current request asks to upgrade to HTTP/2 (h2c)
+     */
+    bool IsHttp2Upgrade() const;
+
+    /**
+     *@brief Switch the connection to HTTP/2, serving the upgrade request
+     * on stream 1
+     *
+     * @param connection the client connection
+     */
+    void HandleHttp2Upgrade(Connection & connection);
 
     /**
-     *@brief Handle the compression operation
+     *@brief Serve one HTTP/2 stream through the HTTP/1.1 handlers
+     *
+     * @param stream_id the stream
+     * @param headers the request headers, pseudo-headers first
+     * @param body the request body
+     * @param client_fd the connection
+     * @param connection_id the `Connection::id' of the connection
+     * @return http2::Session::Response the response of the handlers, or a
+     * deferred one while the workers compress its body
+     */
+    http2::Session::Response
+    HandleHttp2Request(std::uint32_t                      stream_id,
+                       const std::vector<http2::Header> & headers,
+                       const std::string & body, int client_fd,
+                       std::uint64_t connection_id);
+
+    /**
+     *@brief Compress the body of an HTTP/2 response on the worker pool, then
+     * complete its stream if the connection is still there
+     *
+     * @param client_fd the connection
+     * @param connection_id the `Connection::id' of the connection
+     * @param stream_id the stream
+     * @param reply the response, whose body is still uncompressed
+     * @param codec the codec chosen by `HandleCompression()'
+     */
+    void CompressHttp2Response(int client_fd, std::uint64_t connection_id,
+                               std::uint32_t                     stream_id,
+                               std::shared_ptr<message::Message> reply,
+                               compression::Codec                codec);
+
+    /**
+     *@brief Negotiate the content coding and compress the response body
+     *
+     * A large body is left to the workers when `defer_compression' is set,
+     * see `CompressResponse()'.
      */
     void HandleCompression();
 
     /**
-     *@brief Gzip compression function
+     *@brief Serve files from a directory, opened once and used as the
+     * anchor of every file lookup
+     *
+     * @param directory the directory to serve
+     * @return true the directory was opened
+     */
+    bool SetRootDirectory(const std::string & directory);
+
+    /**
+     *@brief Configure a response codec
+     *
+     * @param spec `name:level[:min-size]' or `name:off', e.g. `zstd:3:512'
+     * @return true the specification is valid and the codec is available
+     */
+    bool ConfigureCompression(const std::string & spec);
+
+    /**
+     *@brief Set an admission control option or the listen backlog
+     *
+     * @param option the command line option, e.g. `--rate-limit'
+     * @param value its value
+     * @return true the option was recognized and its value is valid
+     */
+    bool ConfigureAdmission(const std::string & option,
+                            const std::string & value);
+
+    /**
+     *@brief Set a request tracing option
+     *
+     * @param option `--trace-file' or `--trace-sample'
+     * @param value its value
+     * @return true the option is valid
+     */
+    bool ConfigureTracing(const std::string & option,
+                          const std::string & value);
+
+    /**
+     *@brief Set the number of worker threads for CPU-heavy response work
+     *
+     * @param option `--worker-threads'
+     * @param value the count, 0 does everything on the event loop
+     * @return true the option is valid
+     */
+    bool ConfigureWorkers(const std::string & option,
+                          const std::string & value);
+
+    /**
+     *@brief Add a reverse-proxy route
+     *
+     * @param spec `/prefix=upstream[,upstream...]', e.g.
+     * `/api=127.0.0.1:8080,unix:/run/api.sock'
+     * @return true the route is valid
+     */
+    bool ConfigureProxy(const std::string & spec);
+
+    /**
+     *@brief Set a TLS option
      *
-     * @param data
-     * @return std::string data after compression
+     * @param option `--tls-cert', `--tls-key' or `--tls-port'
+     * @param value its value
+     * @return true the option is valid
      */
-    std::string GzipCompression(const std::string & data);
+    bool ConfigureTls(const std::string & option, const std::string & value);
 
     /**
      *@brief Set the `Connection' header in response
@@ -0,0 +1,128 @@
+#include "task.h"
+#include <array>
+#include <cerrno>
+#include <new>
+#include <unistd.h>
+
+// Frames are rounded up to this many bytes, one free list per multiple
+constexpr std::size_t FRAME_GRANULARITY = 64;
+// Larger frames are rare and come from the heap
+constexpr std::size_t MAX_POOLED_FRAME = 4096;
+
+/**
+ *@brief A free frame, linked through its own storage
+ */
+struct FreeFrame
+{
+    FreeFrame * next;
+};
+
+static thread_local std::array<FreeFrame *,
+                               MAX_POOLED_FRAME / FRAME_GRANULARITY + 1>
+    free_frames{};
+
+void * task::FramePool::Allocate(std::size_t size)
+{
+    std::size_t size_class = (size + FRAME_GRANULARITY - 1) / FRAME_GRANULARITY;
+
+    if (size_class >= free_frames.size())
+        return ::operator new(size);
+
+    if (FreeFrame * frame = free_frames[size_class])
+    {
+        free_frames[size_class] = frame->next;
+        return frame;
+    }
+
+    return ::operator new(size_class * FRAME_GRANULARITY);
+}
+
+void task::FramePool::Deallocate(void * frame, std::size_t size)
+{
+    std::size_t size_class = (size + FRAME_GRANULARITY - 1) / FRAME_GRANULARITY;
+
+    if (size_class >= free_frames.size())
+    {
+        ::operator delete(frame);
+        return;
+    }
+
+    FreeFrame * free_frame  = static_cast<FreeFrame *>(frame);
+    free_frame->next        = free_frames[size_class];
+    free_frames[size_class] = free_frame;
+
+    return;
+}
+
+task::File::Descriptor::~Descriptor() { close(fd); }
+
+task::File::File(int file_fd, Offload file_offload)
+    : offload(std::move(file_offload))
+{
+    if (file_fd >= 0)
+        descriptor = std::make_shared<Descriptor>(file_fd);
+}
+
+task::FileAwaiter<bool> task::File::Write(std::string data) const
+{
+    auto result = std::make_shared<bool>(false);
+
+    return {offload, result,
+            [descriptor = descriptor, data = std::move(data), result] {
+                std::size_t written = 0;
+
+                if (!descriptor)
+                    return;
+
+                while (written < data.size())
+                {
+                    ssize_t count = write(descriptor->fd, data.data() + written,
+                                          data.size() - written);
+
+                    if (count < 0 && errno == EINTR)
+                        continue;
+
+                    if (count <= 0)
+                        return;
+
+                    written += count;
+                }
+
+                *result = true;
+            }};
+}
+
+task::FileAwaiter<std::optional<std::string>>
+task::File::Read(off_t offset, std::size_t length) const
+{
+    auto result = std::make_shared<std::optional<std::string>>();
+
+    return {offload, result, [descriptor = descriptor, offset, length, result] {
+                if (!descriptor)
+                    return;
+
+                std::string data(length, '\0');
+                std::size_t done = 0;
+
+                while (done < length)
+                {
+                    ssize_t count = pread(descriptor->fd, data.data() + done,
+                                          length - done, offset + done);
+
+                    if (count < 0 && errno == EINTR)
+                        continue;
+
+                    if (count < 0)
+                        return;
+
+                    // The end of the file
+                    if (count == 0)
+                        break;
+
+                    done += count;
+                }
+
+                data.resize(done);
+                *result = std::move(data);
+            }};
+}
@@ -0,0 +1,282 @@
+#ifndef _TASK_H_
+#define _TASK_H_
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+
+#define BEGIN_TASK_NAMESPACE \
+    namespace task           \
+    {
+#define END_TASK_NAMESPACE }
+
+BEGIN_TASK_NAMESPACE
+
+/**
+ *@brief Free lists of coroutine frames by size class, so suspended
+ * handlers do not cost a heap allocation each
+ *
+ * Frames are owned by the event loop thread. Freed frames are kept for
+ * the next request instead of being returned to the heap.
+ */
+class FramePool
+{
+public:
+    static void * Allocate(std::size_t size);
+
+    static void Deallocate(void * frame, std::size_t size);
+};
+
+/**
+ *@brief Base of the promise types: their frames come from `FramePool'
+ */
+struct PooledFrame
+{
+    static void * operator new(std::size_t size)
+    {
+        return FramePool::Allocate(size);
+    }
+
+    static void operator delete(void * frame, std::size_t size)
+    {
+        FramePool::Deallocate(frame, size);
+    }
+};
+
+/**
+ *@brief Where a task keeps its result until it is awaited
+ */
+template <typename T> struct TaskResult
+{
+    std::optional<T> value;
+
+    void return_value(T result) { value = std::move(result); }
+
+    T Take() { return std::move(*value); }
+};
+
+template <> struct TaskResult<void>
+{
+    void return_void() {}
+
+    void Take() {}
+};
+
+/**
+ *@brief A lazily started coroutine
+ *
+ * Awaiting a task runs it and resumes the awaiting coroutine when it
+ * finishes. The task that serves a request is started with `Start()' and
+ * owned by its connection; destroying it destroys the suspended frame.
+ */
+template <typename T = void> class [[nodiscard]] Task
+{
+public:
+    struct promise_type : PooledFrame, TaskResult<T>
+    {
+        std::coroutine_handle<> continuation; /* The awaiting coroutine */
+        std::exception_ptr      error;
+
+        Task get_return_object()
+        {
+            return Task(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+
+            // Continue with the awaiting coroutine without growing the stack
+            std::coroutine_handle<>
+            await_suspend(std::coroutine_handle<promise_type> self) noexcept
+            {
+                std::coroutine_handle<> next = self.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+public:
+    Task() {}
+    Task(const Task &)             = delete;
+    Task & operator=(const Task &) = delete;
+
+    Task(Task && other) noexcept : handle(std::exchange(other.handle, {})) {}
+
+    Task & operator=(Task && other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    /**
+     *@brief Run the task until it first suspends
+     */
+    void Start() { handle.resume(); }
+
+    bool Done() const { return !handle || handle.done(); }
+
+    /**
+     *@brief Get the result of a finished task, rethrowing its exception
+     */
+    T Result()
+    {
+        if (handle.promise().error)
+            std::rethrow_exception(handle.promise().error);
+
+        return handle.promise().Take();
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct Awaiter
+        {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<>
+            await_suspend(std::coroutine_handle<> awaiting) noexcept
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+
+            T await_resume()
+            {
+                if (handle.promise().error)
+                    std::rethrow_exception(handle.promise().error);
+
+                return handle.promise().Take();
+            }
+        };
+
+        return Awaiter{handle};
+    }
+};
+
+/**
+ *@brief Runs blocking work away from the event loop, then resumes the
+ * awaiting coroutine on the event loop thread
+ */
+using Offload =
+    std::function<void(std::function<void()> work,
+                       std::coroutine_handle<> awaiting)>;
+
+/**
+ *@brief An awaitable file operation, run through an `Offload' or right
+ * away without one
+ *
+ * The operation owns what it touches, since the awaiting frame may be
+ * destroyed while it runs.
+ */
+template <typename T> struct FileAwaiter
+{
+    const Offload &       offload;
+    std::shared_ptr<T>    result;
+    std::function<void()> operation; /* Stores into `result' */
+
+    bool await_ready()
+    {
+        if (offload)
+            return false;
+
+        operation();
+        return true;
+    }
+
+    void await_suspend(std::coroutine_handle<> awaiting)
+    {
+        offload(std::move(operation), awaiting);
+    }
+
+    T await_resume() { return std::move(*result); }
+};
+
+/**
+ *@brief An open file for handlers, closed once its frame and its running
+ * operations are done with it
+ *
+ * Regular files are always ready as far as epoll is concerned, a read or
+ * write blocks the thread that makes it; with an `Offload' the handler
+ * suspends while a worker does it.
+ */
+class File
+{
+private:
+    struct Descriptor
+    {
+        int fd;
+
+        ~Descriptor();
+    };
+
+    std::shared_ptr<Descriptor> descriptor;
+    Offload                     offload;
+
+public:
+    /**
+     *@param file_fd the open file, owned from now on, or -1
+     * @param file_offload where reads and writes run, none for the calling
+     * thread
+     */
+    explicit File(int file_fd, Offload file_offload = {});
+    File(const File &)             = delete;
+    File & operator=(const File &) = delete;
+    File(File && other) noexcept            = default;
+
+    bool IsOpen() const { return descriptor != nullptr; }
+
+    /**
+     *@brief Append data at the file offset
+     *
+     * @return awaitable for whether all of it was written
+     */
+    FileAwaiter<bool> Write(std::string data) const;
+
+    /**
+     *@brief Read a range of the file, without moving the file offset
+     *
+     * @param offset where the range starts
+     * @param length the length of the range
+     * @return awaitable for the bytes read, fewer at the end of the file,
+     * none on an error
+     */
+    FileAwaiter<std::optional<std::string>> Read(off_t       offset,
+                                                 std::size_t length) const;
+};
+
+END_TASK_NAMESPACE
+
+#endif // !_TASK_H_
@@ -0,0 +1,273 @@
+#include "tls.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <iostream>
+#include <unistd.h>
+
+#ifdef HAVE_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+// Plaintext read from a file per record when encrypting in user space
+constexpr std::size_t TLS_FILE_CHUNK = 16384;
+
+bool tls::Context::Configure(const std::string & option,
+                             const std::string & value)
+{
+    if (option == "--tls-cert")
+        certificate_file = value;
+    else if (option == "--tls-key")
+        key_file = value;
+    else if (option == "--tls-port")
+    {
+        int parsed = 0;
+        auto [end, error] =
+            std::from_chars(value.data(), value.data() + value.size(), parsed);
+
+        if (error != std::errc() || end != value.data() + value.size() ||
+            parsed <= 0 || parsed > 65535)
+            return false;
+
+        port = parsed;
+    }
+    else
+        return false;
+
+    return true;
+}
+
+#ifdef HAVE_OPENSSL
+
+/**
+ *@brief Choose the ALPN protocol, preferring HTTP/2
+ */
+static int selectProtocol(SSL *, const unsigned char ** out,
+                          unsigned char * out_length, const unsigned char * in,
+                          unsigned int in_length, void *)
+{
+    static const unsigned char PROTOCOLS[] = "\x02h2\x08http/1.1";
+
+    if (SSL_select_next_proto(const_cast<unsigned char **>(out), out_length,
+                              PROTOCOLS, sizeof(PROTOCOLS) - 1, in,
+                              in_length) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+
+    return SSL_TLSEXT_ERR_OK;
+}
+
+tls::Session::~Session()
+{
+    SSL_free(ssl);
+}
+
+ssize_t tls::Session::Result(int result)
+{
+    want_write = false;
+
+    if (result > 0)
+        return result;
+
+    switch (SSL_get_error(ssl, result))
+    {
+    case SSL_ERROR_WANT_READ:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_WANT_WRITE:
+        want_write = true;
+        errno      = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    default:
+        ERR_clear_error();
+        errno = EIO;
+        return -1;
+    }
+}
+
+tls::Session::Handshake tls::Session::Advance()
+{
+    ERR_clear_error();
+
+    int result = SSL_do_handshake(ssl);
+
+    if (result != 1)
+        return Result(result) < 0 && errno == EAGAIN ? Handshake::WANT_IO
+                                                     : Handshake::ERROR;
+
+    const unsigned char * selected;
+    unsigned int          selected_length = 0;
+    SSL_get0_alpn_selected(ssl, &selected, &selected_length);
+
+    protocol.assign(reinterpret_cast<const char *>(selected), selected_length);
+    kernel_send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+    established = true;
+    want_write  = false;
+
+    return Handshake::DONE;
+}
+
+ssize_t tls::Session::Read(char * buffer, std::size_t length)
+{
+    ERR_clear_error();
+
+    return Result(
+        SSL_read(ssl, buffer, static_cast<int>(std::min<std::size_t>(
+                                  length, INT_MAX))));
+}
+
+ssize_t tls::Session::Write(const char * buffer, std::size_t length)
+{
+    ERR_clear_error();
+
+    return Result(
+        SSL_write(ssl, buffer, static_cast<int>(std::min<std::size_t>(
+                                   length, INT_MAX))));
+}
+
+ssize_t tls::Session::WriteFile(int file_fd, off_t * offset,
+                                std::size_t length)
+{
+    char buffer[TLS_FILE_CHUNK];
+
+    // A retried write reads the same bytes again, as OpenSSL requires
+    ssize_t read_bytes = pread(file_fd, buffer,
+                               std::min(length, sizeof(buffer)), *offset);
+
+    if (read_bytes <= 0)
+        return read_bytes;
+
+    ssize_t written = Write(buffer, read_bytes);
+
+    if (written > 0)
+        *offset += written;
+
+    return written;
+}
+
+void tls::Session::Shutdown()
+{
+    if (!established)
+        return;
+
+    ERR_clear_error();
+    SSL_shutdown(ssl);
+
+    return;
+}
+
+tls::Context::~Context()
+{
+    SSL_CTX_free(context);
+}
+
+bool tls::Context::Initialize()
+{
+    context = SSL_CTX_new(TLS_server_method());
+
+    if (context == nullptr)
+    {
+        ERR_print_errors_fp(stderr);
+        return false;
+    }
+
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+
+    // Hand the record layer to the kernel once the keys are known
+    SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS |
+                                     SSL_OP_IGNORE_UNEXPECTED_EOF |
+                                     SSL_OP_NO_RENEGOTIATION |
+                                     SSL_OP_CIPHER_SERVER_PREFERENCE);
+
+    // `Write()' may send part of a buffer, like `send()'
+    SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                  SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                                  SSL_MODE_RELEASE_BUFFERS);
+
+    // Resumption with the session cache (TLS 1.2) and tickets (both)
+    static const unsigned char SESSION_CONTEXT[] = "http-server";
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(context, SESSION_CONTEXT,
+                                   sizeof(SESSION_CONTEXT) - 1);
+    SSL_CTX_set_num_tickets(context, 1);
+
+    SSL_CTX_set_alpn_select_cb(context, selectProtocol, nullptr);
+
+    if (SSL_CTX_use_certificate_chain_file(context,
+                                           certificate_file.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(
+            context, (key_file.empty() ? certificate_file : key_file).c_str(),
+            SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(context) != 1)
+    {
+        ERR_print_errors_fp(stderr);
+        return false;
+    }
+
+    return true;
+}
+
+std::unique_ptr<tls::Session> tls::Context::NewSession(int fd)
+{
+    SSL * ssl = SSL_new(context);
+
+    if (ssl == nullptr || SSL_set_fd(ssl, fd) != 1)
+    {
+        SSL_free(ssl);
+        return nullptr;
+    }
+
+    SSL_set_accept_state(ssl);
+
+    return std::make_unique<Session>(ssl);
+}
+
+#else // !HAVE_OPENSSL
+
+tls::Session::~Session() {}
+
+ssize_t tls::Session::Result(int)
+{
+    errno = EIO;
+    return -1;
+}
+
+tls::Session::Handshake tls::Session::Advance()
+{
+    return Handshake::ERROR;
+}
+
+ssize_t tls::Session::Read(char *, std::size_t)
+{
+    return Result(0);
+}
+
+ssize_t tls::Session::Write(const char *, std::size_t)
+{
+    return Result(0);
+}
+
+ssize_t tls::Session::WriteFile(int, off_t *, std::size_t)
+{
+    return Result(0);
+}
+
+void tls::Session::Shutdown() {}
+
+tls::Context::~Context() {}
+
+bool tls::Context::Initialize()
+{
+    std::cerr << "This server was built without OpenSSL\n";
+    return false;
+}
+
+std::unique_ptr<tls::Session> tls::Context::NewSession(int)
+{
+    return nullptr;
+}
+
+#endif // HAVE_OPENSSL
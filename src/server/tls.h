@@ -0,0 +1,147 @@
+#ifndef _TLS_H_
+#define _TLS_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+#define BEGIN_TLS_NAMESPACE \
+    namespace tls           \
+    {
+#define END_TLS_NAMESPACE }
+
+// OpenSSL types, kept out of the headers
+struct ssl_st;
+struct ssl_ctx_st;
+
+BEGIN_TLS_NAMESPACE
+
+/**
+ *@brief The TLS state of one connection
+ *
+ * `Read()' and `Write()' behave like `recv()' and `send()' on a
+ * non-blocking socket: they fail with `EAGAIN' until the socket is ready.
+ * Once the kernel encrypts what is sent (kTLS), plain `writev()' and
+ * `sendfile()' on the socket are used instead of `Write()'.
+ */
+class Session
+{
+private:
+    ssl_st *    ssl;
+    bool        established = false;
+    bool        kernel_send = false; /* kTLS transmit is on */
+    bool        want_write  = false; /* OpenSSL waits for a writable socket */
+    std::string protocol;            /* Negotiated with ALPN */
+
+    /**
+     *@brief Turn the result of an OpenSSL call into `recv()' semantics
+     */
+    ssize_t Result(int result);
+
+public:
+    enum class Handshake
+    {
+        DONE,
+        WANT_IO, /* Wait for the socket, see `WantsWrite()' */
+        ERROR,
+    };
+
+    Session(ssl_st * ssl) : ssl(ssl) {}
+    Session(const Session &)             = delete;
+    Session & operator=(const Session &) = delete;
+    ~Session();
+
+    /**
+     *@brief Advance the handshake as far as the socket allows
+     */
+    Handshake Advance();
+
+    bool Established() const { return established; }
+
+    /**
+     *@brief Whether the kernel encrypts what is written to the socket
+     */
+    bool KernelSend() const { return kernel_send; }
+
+    /**
+     *@brief Whether the last operation waits for the socket to be writable
+     */
+    bool WantsWrite() const { return want_write; }
+
+    /**
+     *@brief The ALPN protocol, e.g. `h2', or empty
+     */
+    const std::string & Protocol() const { return protocol; }
+
+    ssize_t Read(char * buffer, std::size_t length);
+
+    ssize_t Write(const char * buffer, std::size_t length);
+
+    /**
+     *@brief Encrypt and send part of a file in user space
+     *
+     * @param file_fd the file
+     * @param offset where to read, advanced by the bytes sent
+     * @param length the most bytes to send
+     */
+    ssize_t WriteFile(int file_fd, off_t * offset, std::size_t length);
+
+    /**
+     *@brief Send `close_notify' if the socket takes it right away
+     */
+    void Shutdown();
+};
+
+/**
+ *@brief The server certificate and the settings shared by all sessions:
+ * ALPN, session resumption and kTLS
+ */
+class Context
+{
+private:
+    ssl_ctx_st * context = nullptr;
+    std::string  certificate_file;
+    std::string  key_file;
+    int          port = 4443;
+
+public:
+    Context() {}
+    Context(const Context &)             = delete;
+    Context & operator=(const Context &) = delete;
+    ~Context();
+
+    /**
+     *@brief Apply a command line option
+     *
+     * @param option `--tls-cert', `--tls-key' or `--tls-port'
+     * @param value its value
+     * @return true the option belongs to TLS and is valid
+     */
+    bool Configure(const std::string & option, const std::string & value);
+
+    /**
+     *@brief Whether a certificate was given
+     */
+    bool Enabled() const { return !certificate_file.empty(); }
+
+    int GetPort() const { return port; }
+
+    /**
+     *@brief Load the certificate and key
+     *
+     * @return false they cannot be used, the reason is printed
+     */
+    bool Initialize();
+
+    /**
+     *@brief Start the server side of TLS on an accepted socket
+     *
+     * @return std::unique_ptr<Session> the session, or nullptr on failure
+     */
+    std::unique_ptr<Session> NewSession(int fd);
+};
+
+END_TLS_NAMESPACE
+
+#endif // !_TLS_H_
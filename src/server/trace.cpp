@@ -0,0 +1,203 @@
+#include "trace.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <unistd.h>
+
+#ifdef TRACE_X86
+#include <cpuid.h>
+#endif
+
+#ifdef HAVE_SDT
+// The probes get semaphores, which the kernel raises while a tracer is
+// attached, so the per-phase work is skipped when nobody listens
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+__extension__ unsigned short http_server_phase_semaphore
+    __attribute__((unused)) __attribute__((section(".probes")));
+__extension__ unsigned short http_server_request_semaphore
+    __attribute__((unused)) __attribute__((section(".probes")));
+
+#define HTTP_SERVER_PHASE_ENABLED() \
+    __builtin_expect(http_server_phase_semaphore, 0)
+#define HTTP_SERVER_REQUEST_ENABLED() \
+    __builtin_expect(http_server_request_semaphore, 0)
+#endif
+
+// Buffered events are written out past this size
+constexpr std::size_t TRACE_BUFFER_LIMIT = 64 * 1024;
+
+static const char * const PHASE_NAMES[] = {
+    "receive", "parse", "route", "file_io", "compress", "send",
+};
+
+const bool trace::USE_TSC = []() {
+#ifdef TRACE_X86
+    unsigned eax, ebx, ecx, edx;
+
+    // CPUID 0x80000007: EDX bit 8 is set when the TSC rate is constant
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) &&
+           (edx & (1u << 8)) != 0;
+#else
+    return false;
+#endif
+}();
+
+trace::Tracer::Tracer()
+{
+    if (USE_TSC)
+    {
+        // Measure the TSC rate against the monotonic clock for a moment
+        auto  start       = std::chrono::steady_clock::now();
+        Ticks start_ticks = Now();
+        auto  elapsed     = std::chrono::nanoseconds(0);
+
+        while (elapsed < std::chrono::milliseconds(2))
+            elapsed = std::chrono::steady_clock::now() - start;
+
+        ns_per_tick = static_cast<double>(elapsed.count()) /
+                      static_cast<double>(Now() - start_ticks);
+    }
+
+    base = Now();
+}
+
+trace::Tracer::~Tracer()
+{
+    if (!file)
+        return;
+
+    Flush();
+    std::fputs("\n]\n", file);
+    std::fclose(file);
+}
+
+bool trace::Tracer::Configure(const std::string & option,
+                              const std::string & value)
+{
+    if (option == "--trace-file")
+    {
+        if (file)
+            std::fclose(file);
+
+        file = std::fopen(value.c_str(), "we");
+        if (!file)
+            return false;
+
+        std::fputs("[\n", file);
+        first_event = true;
+        return true;
+    }
+
+    if (option == "--trace-sample")
+    {
+        unsigned every = 0;
+        auto [end, error] =
+            std::from_chars(value.data(), value.data() + value.size(), every);
+
+        if (error != std::errc() || end != value.data() + value.size() ||
+            every == 0)
+            return false;
+
+        sample_every = every;
+        return true;
+    }
+
+    return false;
+}
+
+void trace::Tracer::Finish(const RequestTrace & request_trace)
+{
+#ifdef HAVE_SDT
+    if (HTTP_SERVER_PHASE_ENABLED() || HTTP_SERVER_REQUEST_ENABLED())
+    {
+        Ticks first = ~Ticks(0), last = 0;
+
+        for (int i = 0; i < static_cast<int>(Phase::COUNT); i++)
+        {
+            if (!request_trace.Spans(i))
+                continue;
+
+            Ticks spent = request_trace.end[i] - request_trace.begin[i];
+            DTRACE_PROBE3(http_server, phase, request_trace.id,
+                          PHASE_NAMES[i],
+                          static_cast<std::uint64_t>(spent * ns_per_tick));
+
+            first = std::min(first, request_trace.begin[i]);
+            last  = std::max(last, request_trace.end[i]);
+        }
+
+        if (last != 0)
+            DTRACE_PROBE4(
+                http_server, request, request_trace.id, request_trace.status,
+                static_cast<std::uint64_t>((last - first) * ns_per_tick),
+                request_trace.connection);
+    }
+#endif
+
+    if (!file || request_trace.id % sample_every != 0)
+        return;
+
+    AppendEvents(request_trace);
+
+    if (buffer.size() >= TRACE_BUFFER_LIMIT)
+        Flush();
+
+    return;
+}
+
+void trace::Tracer::AppendEvents(const RequestTrace & request_trace)
+{
+    const double us_per_tick = ns_per_tick / 1000;
+    const int    pid         = getpid();
+    Ticks        first = ~Ticks(0), last = 0;
+    char         event[256];
+
+    auto append = [&](const char * name, Ticks begin, Ticks end) {
+        int length = std::snprintf(
+            event, sizeof(event),
+            "%s{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%.3f,"
+            "\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"id\":%llu,"
+            "\"status\":%d}}",
+            first_event ? "" : ",\n", name,
+            (begin - base) * us_per_tick, (end - begin) * us_per_tick, pid,
+            request_trace.connection,
+            static_cast<unsigned long long>(request_trace.id),
+            request_trace.status);
+
+        buffer.append(event, std::min<std::size_t>(length, sizeof(event) - 1));
+        first_event = false;
+    };
+
+    for (int i = 0; i < static_cast<int>(Phase::COUNT); i++)
+    {
+        if (!request_trace.Spans(i))
+            continue;
+
+        first = std::min(first, request_trace.begin[i]);
+        last  = std::max(last, request_trace.end[i]);
+    }
+
+    if (last == 0)
+        return;
+
+    // The request first so that viewers nest the phases under it
+    append("request", first, last);
+
+    for (int i = 0; i < static_cast<int>(Phase::COUNT); i++)
+        if (request_trace.Spans(i))
+            append(PHASE_NAMES[i], request_trace.begin[i],
+                   request_trace.end[i]);
+
+    return;
+}
+
+void trace::Tracer::Flush()
+{
+    std::fwrite(buffer.data(), 1, buffer.size(), file);
+    std::fflush(file);
+    buffer.clear();
+
+    return;
+}
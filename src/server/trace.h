@@ -0,0 +1,154 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_X86 1
+#endif
+
+#define BEGIN_TRACE_NAMESPACE \
+    namespace trace           \
+    {
+#define END_TRACE_NAMESPACE }
+
+BEGIN_TRACE_NAMESPACE
+
+/**
+ * The phases of a request. `ROUTE' covers the handler and contains
+ * `FILE_IO' and `COMPRESS'; the others do not overlap.
+ */
+enum class Phase : std::uint8_t
+{
+    RECEIVE,  /* First byte read until the request is complete */
+    PARSE,    /* Request line and headers */
+    ROUTE,    /* `SetResponse()' dispatch and the handler */
+    FILE_IO,  /* Opening, reading or writing the served file */
+    COMPRESS, /* Loading and compressing the body */
+    SEND,     /* Queued until the last byte is written to the socket */
+    COUNT,
+};
+
+using Ticks = std::uint64_t;
+
+// Whether `Now()' reads the invariant TSC, set once before `main()'
+extern const bool USE_TSC;
+
+/**
+ *@brief Read the cycle counter, or the monotonic clock in nanoseconds
+ * where there is no invariant TSC
+ */
+inline Ticks Now()
+{
+#ifdef TRACE_X86
+    if (USE_TSC)
+        return __rdtsc();
+#endif
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<Ticks>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/**
+ *@brief The phase timestamps of one request
+ */
+struct RequestTrace
+{
+    std::uint64_t id         = 0;
+    int           connection = -1; /* Client fd, the trace thread */
+    int           status     = 0;
+    std::uint64_t send_end   = 0; /* Output offset of the last byte */
+
+    Ticks begin[static_cast<int>(Phase::COUNT)] = {};
+    Ticks end[static_cast<int>(Phase::COUNT)]   = {};
+
+    void Begin(Phase phase, Ticks now = Now())
+    {
+        begin[static_cast<int>(phase)] = now;
+    }
+
+    void End(Phase phase, Ticks now = Now())
+    {
+        end[static_cast<int>(phase)] = now;
+    }
+
+    /**
+     *@brief Whether a phase was entered and left again; a request cut
+     * short can leave a phase open
+     */
+    bool Spans(int phase) const
+    {
+        return begin[phase] != 0 && end[phase] >= begin[phase];
+    }
+};
+
+/**
+ *@brief Publish finished request traces to USDT probes and, for a sample
+ * of them, to a Chrome trace-event JSON file
+ */
+class Tracer
+{
+private:
+    std::FILE *   file         = nullptr;
+    unsigned      sample_every = 100; /* 1 in N requests is written */
+    std::uint64_t next_id      = 0;
+    std::string   buffer;             /* Events not written to the file yet */
+    bool          first_event  = true;
+
+    // Converts ticks into nanoseconds since `base'
+    Ticks  base;
+    double ns_per_tick = 1.0;
+
+    /**
+     *@brief Append the request and its phases as complete (`X') events
+     */
+    void AppendEvents(const RequestTrace & request_trace);
+
+    /**
+     *@brief Write the buffered events to the file
+     */
+    void Flush();
+
+public:
+    Tracer();
+    Tracer(const Tracer &)             = delete;
+    Tracer & operator=(const Tracer &) = delete;
+    ~Tracer();
+
+    /**
+     *@brief Apply a command line option
+     *
+     * `--trace-file path' writes sampled requests as Chrome trace-event
+     * JSON, `--trace-sample N' writes 1 in N of them.
+     *
+     * @return true the option belongs to the tracer and is valid
+     */
+    bool Configure(const std::string & option, const std::string & value);
+
+    /**
+     *@brief Start the trace of a new request
+     *
+     * @param connection the client fd
+     */
+    RequestTrace Start(int connection)
+    {
+        RequestTrace request_trace;
+        request_trace.id         = next_id++;
+        request_trace.connection = connection;
+        return request_trace;
+    }
+
+    /**
+     *@brief Fire the probes for a finished request and keep it if sampled
+     */
+    void Finish(const RequestTrace & request_trace);
+};
+
+END_TRACE_NAMESPACE
+
+#endif // !_TRACE_H_
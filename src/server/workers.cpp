@@ -0,0 +1,218 @@
+#include "workers.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+workers::ThreadPool::ThreadPool()
+{
+    // The event loop keeps a core to itself
+    unsigned int cores = std::thread::hardware_concurrency();
+    thread_count       = cores > 1 ? cores - 1 : 1;
+}
+
+workers::ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    // Jobs still queued are dropped, the running ones are waited for
+    for (auto & worker : workers) worker->thread.join();
+
+    if (completion_fd >= 0)
+        close(completion_fd);
+}
+
+bool workers::ThreadPool::Configure(const std::string & option,
+                                    const std::string & value)
+{
+    if (option != "--worker-threads")
+        return false;
+
+    // The whole value must be a count, `4x' or `-1' is refused; 0 runs the
+    // jobs on the event loop
+    std::size_t count = 0;
+    auto [end, error] =
+        std::from_chars(value.data(), value.data() + value.size(), count);
+
+    if (error != std::errc() || end != value.data() + value.size() ||
+        count > MAX_THREADS)
+        return false;
+
+    thread_count = count;
+    return true;
+}
+
+bool workers::ThreadPool::Start()
+{
+    if (thread_count == 0)
+        return true;
+
+    completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (completion_fd < 0)
+        return false;
+
+    // With a single worker bulk jobs cannot be kept off it
+    bulk_limit = std::max<std::size_t>(thread_count - 1, 1);
+
+    for (std::size_t i = 0; i < thread_count; i++)
+        workers.push_back(std::make_unique<Worker>());
+    for (std::size_t i = 0; i < thread_count; i++)
+        workers[i]->thread = std::thread(&ThreadPool::WorkerLoop, this, i);
+
+    return true;
+}
+
+void workers::ThreadPool::Submit(Priority priority, Function work,
+                                 Function completion)
+{
+    Worker & worker = *workers[next_worker];
+    next_worker     = (next_worker + 1) % workers.size();
+
+    {
+        // Counted together with the push, so a taker never sees it uncounted
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        {
+            std::lock_guard<std::mutex> queue_lock(worker.mutex);
+            worker.queues[static_cast<int>(priority)].push_back(
+                {std::move(work), std::move(completion)});
+        }
+        pending[static_cast<int>(priority)]++;
+    }
+    wake.notify_one();
+
+    return;
+}
+
+workers::Priority workers::ThreadPool::Take(std::size_t index, Job & job)
+{
+    for (Priority priority : {Priority::LATENCY, Priority::BULK})
+    {
+        int p = static_cast<int>(priority);
+
+        // Reserve a bulk slot before looking for a bulk job
+        if (priority == Priority::BULK)
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            if (pending[p] == 0 || bulk_running >= bulk_limit)
+                break;
+            bulk_running++;
+        }
+
+        for (std::size_t k = 0; k < workers.size(); k++)
+        {
+            Worker & victim = *workers[(index + k) % workers.size()];
+
+            {
+                std::lock_guard<std::mutex> queue_lock(victim.mutex);
+                std::deque<Job> &           queue = victim.queues[p];
+
+                if (queue.empty())
+                    continue;
+
+                // The oldest own job, or the newest of another worker
+                if (k == 0)
+                {
+                    job = std::move(queue.front());
+                    queue.pop_front();
+                }
+                else
+                {
+                    job = std::move(queue.back());
+                    queue.pop_back();
+                }
+            }
+
+            // Not before `Submit()' counted it, it holds the lock meanwhile
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            pending[p]--;
+            return priority;
+        }
+
+        if (priority == Priority::BULK)
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            bulk_running--;
+        }
+    }
+
+    return Priority::COUNT;
+}
+
+void workers::ThreadPool::WorkerLoop(std::size_t index)
+{
+    constexpr int LATENCY = static_cast<int>(Priority::LATENCY);
+    constexpr int BULK    = static_cast<int>(Priority::BULK);
+
+    while (true)
+    {
+        Job      job;
+        Priority priority = Take(index, job);
+
+        if (priority == Priority::COUNT)
+        {
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] {
+                return stopping || pending[LATENCY] > 0 ||
+                       (pending[BULK] > 0 && bulk_running < bulk_limit);
+            });
+
+            if (stopping)
+                return;
+            continue;
+        }
+
+        try
+        {
+            job.work();
+        }
+        catch (const std::exception & e)
+        {
+            std::cerr << e.what() << '\n';
+        }
+        job.work = nullptr; /* Release what it owned on this thread */
+
+        {
+            std::lock_guard<std::mutex> lock(completion_mutex);
+            completions.push_back(std::move(job.completion));
+        }
+
+        // EAGAIN only if the counter would overflow, the loop is woken then
+        std::uint64_t one = 1;
+        while (write(completion_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+
+        // A bulk slot is free again
+        if (priority == Priority::BULK)
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                bulk_running--;
+            }
+            wake.notify_one();
+        }
+    }
+}
+
+void workers::ThreadPool::RunCompletions()
+{
+    // Reset the counter; EAGAIN means an earlier call already did
+    std::uint64_t count;
+    while (read(completion_fd, &count, sizeof(count)) < 0 && errno == EINTR);
+
+    std::vector<Function> ready;
+    {
+        std::lock_guard<std::mutex> lock(completion_mutex);
+        ready.swap(completions);
+    }
+
+    for (Function & completion : ready) completion();
+
+    return;
+}
@@ -0,0 +1,131 @@
+#ifndef _WORKERS_H_
+#define _WORKERS_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define BEGIN_WORKERS_NAMESPACE \
+    namespace workers           \
+    {
+#define END_WORKERS_NAMESPACE }
+
+BEGIN_WORKERS_NAMESPACE
+
+// Upper bound of `--worker-threads'
+constexpr std::size_t MAX_THREADS = 256;
+
+enum class Priority
+{
+    LATENCY, /* A small response someone is waiting on */
+    BULK,    /* Large bodies, never allowed to take every worker */
+    COUNT,
+};
+
+/**
+ *@brief Threads for CPU-heavy work such as compression, so the event loop
+ * keeps serving while it runs
+ *
+ * Jobs are spread over per-worker deques. A worker takes from the front of
+ * its own deque and steals from the back of the others when it runs dry;
+ * latency jobs are always taken before bulk ones, and one worker is kept
+ * away from bulk jobs. Completions are posted back to the event loop, which
+ * runs them when the completion file descriptor is readable.
+ */
+class ThreadPool
+{
+private:
+    using Function = std::function<void()>;
+
+    struct Job
+    {
+        Function work;       /* Runs on a worker */
+        Function completion; /* Runs on the event loop thread */
+    };
+
+    struct Worker
+    {
+        std::mutex      mutex;
+        std::deque<Job> queues[static_cast<int>(Priority::COUNT)];
+        std::thread     thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::size_t thread_count = 0;
+    std::size_t next_worker  = 0; /* Round-robin, event loop thread only */
+
+    // Guards the counters below and the sleep of idle workers
+    std::mutex              sleep_mutex;
+    std::condition_variable wake;
+    std::size_t             pending[static_cast<int>(Priority::COUNT)] = {};
+    std::size_t             bulk_running = 0;
+    std::size_t             bulk_limit   = 0;
+    bool                    stopping     = false;
+
+    std::mutex            completion_mutex;
+    std::vector<Function> completions;
+    int                   completion_fd = -1; /* eventfd */
+
+    /**
+     *@brief Take a job from the own deque or steal one
+     *
+     * @return Priority the priority of the job taken, or `COUNT' if there is
+     * nothing this worker may run
+     */
+    Priority Take(std::size_t index, Job & job);
+
+    void WorkerLoop(std::size_t index);
+
+public:
+    ThreadPool();
+    ThreadPool(const ThreadPool &)             = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+    ~ThreadPool();
+
+    /**
+     *@brief Apply a command line option
+     *
+     * @param option `--worker-threads', 0 runs the jobs on the event loop
+     * @param value its value
+     * @return true the option is valid
+     */
+    bool Configure(const std::string & option, const std::string & value);
+
+    /**
+     *@brief Start the workers
+     *
+     * @return false the completion eventfd could not be created
+     */
+    bool Start();
+
+    bool Enabled() const { return !workers.empty(); }
+
+    /**
+     *@brief The eventfd that becomes readable when completions are posted
+     */
+    int GetCompletionFd() const { return completion_fd; }
+
+    /**
+     *@brief Queue a job; called from the event loop thread
+     *
+     * @param priority the priority of the job
+     * @param work what runs on a worker, owning everything it touches
+     * @param completion what runs on the event loop once `work' is done
+     */
+    void Submit(Priority priority, Function work, Function completion);
+
+    /**
+     *@brief Run the completions posted so far on the calling thread
+     */
+    void RunCompletions();
+};
+
+END_WORKERS_NAMESPACE
+
+#endif // !_WORKERS_H_
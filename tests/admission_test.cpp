@@ -0,0 +1,87 @@
+#include "../src/server/admission.h"
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+TEST(TokenBucket, RefillsAtTheRateUpToTheBurst)
+{
+    admission::Clock::time_point now = admission::Clock::now();
+    admission::TokenBucket       bucket(2, now);
+
+    EXPECT_TRUE(bucket.Take(4, 2, now));
+    EXPECT_TRUE(bucket.Take(4, 2, now));
+    EXPECT_FALSE(bucket.Take(4, 2, now));
+
+    // A quarter second at 4 tokens/s is one token
+    EXPECT_TRUE(bucket.Take(4, 2, now + 250ms));
+    EXPECT_FALSE(bucket.Take(4, 2, now + 250ms));
+
+    // A long idle time refills no more than the burst
+    EXPECT_FALSE(bucket.IsFull(4, 2, now + 500ms));
+    EXPECT_TRUE(bucket.IsFull(4, 2, now + 10s));
+    EXPECT_TRUE(bucket.Take(4, 2, now + 10s));
+    EXPECT_TRUE(bucket.Take(4, 2, now + 10s));
+    EXPECT_FALSE(bucket.Take(4, 2, now + 10s));
+}
+
+/**
+ *@brief Count the requests from one address admitted in a row
+ */
+static int admittedInARow(admission::AdmissionControl & admission)
+{
+    int admitted = 0;
+
+    while (admitted < 100 && admission.AdmitRequest(0x0100007f))
+        admitted++;
+
+    return admitted;
+}
+
+TEST(AdmissionControl, BurstDefaultsToTheRate)
+{
+    admission::AdmissionControl admission;
+    ASSERT_TRUE(admission.Configure("--rate-limit", "5"));
+
+    EXPECT_EQ(admittedInARow(admission), 5);
+}
+
+TEST(AdmissionControl, BurstIsAtLeastOneRequest)
+{
+    // Below one request per second every request would be refused
+    admission::AdmissionControl admission;
+    ASSERT_TRUE(admission.Configure("--rate-limit", "0.5"));
+
+    EXPECT_EQ(admittedInARow(admission), 1);
+}
+
+TEST(AdmissionControl, ConfiguredBurst)
+{
+    admission::AdmissionControl admission;
+    ASSERT_TRUE(admission.Configure("--rate-limit", "1"));
+    ASSERT_TRUE(admission.Configure("--rate-burst", "3"));
+
+    EXPECT_EQ(admittedInARow(admission), 3);
+
+    // Other addresses have their own bucket
+    EXPECT_TRUE(admission.AdmitRequest(0x0200007f));
+}
+
+TEST(AdmissionControl, UnlimitedWithoutRate)
+{
+    admission::AdmissionControl admission;
+
+    EXPECT_EQ(admittedInARow(admission), 100);
+    EXPECT_FALSE(admission.Configure("--rate-limit", "-1"));
+    EXPECT_FALSE(admission.Configure("--rate-burst", "2x"));
+}
+
+TEST(AdmissionControl, ShedsAboveTheLimits)
+{
+    admission::AdmissionControl admission;
+    ASSERT_TRUE(admission.Configure("--max-connections", "2"));
+    ASSERT_TRUE(admission.Configure("--shed-queue-depth", "10"));
+
+    EXPECT_TRUE(admission.AdmitConnection(1, 0));
+    EXPECT_FALSE(admission.AdmitConnection(2, 0));
+    EXPECT_FALSE(admission.AdmitConnection(1, 11));
+}
@@ -0,0 +1,96 @@
+#include "../src/server/compression.h"
+#include <gtest/gtest.h>
+
+using compression::Codec;
+using Options = std::vector<message::CompressionOption>;
+
+/**
+ *@brief A compressor whose choices do not depend on zstd being built in
+ */
+static compression::Compressor withoutZstd()
+{
+    compression::Compressor compressor;
+
+    compressor.Configure("zstd:off");
+
+    return compressor;
+}
+
+TEST(Negotiate, PicksTheHighestWeight)
+{
+    if (!compression::Compressor::Available(Codec::BROTLI))
+        GTEST_SKIP() << "built without brotli";
+
+    compression::Compressor compressor = withoutZstd();
+
+    EXPECT_EQ(compressor.Negotiate({{"gzip", 0.8}, {"br", 0.5}}, 1000),
+              Codec::GZIP);
+    // Equal weights go to the codec first in `Codec'
+    EXPECT_EQ(compressor.Negotiate({{"gzip", 1.0}, {"br", 1.0}}, 1000),
+              Codec::BROTLI);
+}
+
+TEST(Negotiate, WeighsIdentity)
+{
+    compression::Compressor compressor = withoutZstd();
+
+    EXPECT_EQ(compressor.Negotiate({{"identity", 1.0}, {"gzip", 0.1}}, 1000),
+              Codec::IDENTITY);
+    // A tie goes to identity
+    EXPECT_EQ(compressor.Negotiate({{"identity", 0.5}, {"gzip", 0.5}}, 1000),
+              Codec::IDENTITY);
+    EXPECT_EQ(compressor.Negotiate({{"identity", 0.5}, {"gzip", 0.6}}, 1000),
+              Codec::GZIP);
+}
+
+TEST(Negotiate, AppliesTheWildcard)
+{
+    compression::Compressor compressor = withoutZstd();
+    compressor.Configure("br:off");
+
+    EXPECT_EQ(compressor.Negotiate({{"*", 1.0}}, 1000), Codec::GZIP);
+    EXPECT_EQ(compressor.Negotiate({{"*", 1.0}, {"gzip", 0}}, 1000),
+              Codec::IDENTITY);
+    // `*;q=0' refuses identity too unless it is listed
+    EXPECT_EQ(compressor.Negotiate({{"*", 0}}, 1000), std::nullopt);
+    EXPECT_EQ(compressor.Negotiate({{"*", 0}, {"identity", 0.5}}, 1000),
+              Codec::IDENTITY);
+}
+
+TEST(Negotiate, RefusesWithZeroWeight)
+{
+    compression::Compressor compressor = withoutZstd();
+    compressor.Configure("br:off");
+
+    EXPECT_EQ(compressor.Negotiate({{"gzip", 0}}, 1000), Codec::IDENTITY);
+    EXPECT_EQ(compressor.Negotiate({{"gzip", 0}, {"identity", 0}}, 1000),
+              std::nullopt);
+    EXPECT_EQ(compressor.Negotiate({{"x-gzip", 0.5}, {"identity", 0}}, 1000),
+              Codec::GZIP);
+}
+
+TEST(Negotiate, HonoursTheMinimumSize)
+{
+    compression::Compressor compressor = withoutZstd();
+    compressor.Configure("br:off");
+    ASSERT_TRUE(compressor.Configure("gzip:6:512"));
+
+    EXPECT_EQ(compressor.Negotiate({{"gzip", 1.0}}, 511), Codec::IDENTITY);
+    EXPECT_EQ(compressor.Negotiate({{"gzip", 1.0}}, 512), Codec::GZIP);
+    // Without identity a small body is compressed all the same
+    EXPECT_EQ(compressor.Negotiate({{"gzip", 1.0}, {"identity", 0}}, 10),
+              Codec::GZIP);
+}
+
+TEST(Compressor, RejectsInvalidLevels)
+{
+    compression::Compressor compressor;
+
+    EXPECT_TRUE(compressor.Configure("gzip:0"));
+    EXPECT_TRUE(compressor.Configure("gzip:9:100"));
+    EXPECT_FALSE(compressor.Configure("gzip:42"));
+    EXPECT_FALSE(compressor.Configure("gzip:-1"));
+    EXPECT_FALSE(compressor.Configure("gzip:5x"));
+    EXPECT_FALSE(compressor.Configure("gzip:5:1x"));
+    EXPECT_FALSE(compressor.Configure("gzip:"));
+}
@@ -0,0 +1,123 @@
+#include "../src/server/connection.h"
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ *@brief A non-blocking socket pair with small buffers, so the queue sees
+ * partial writes long before it is drained
+ */
+class OutputQueueTest : public ::testing::Test
+{
+protected:
+    int sockets[2] = {-1, -1}; /* Written by the queue, read by the test */
+
+    void SetUp() override
+    {
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets),
+                  0);
+
+        int size = 16384;
+        setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(sockets[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    void TearDown() override
+    {
+        for (int fd : sockets)
+            if (fd >= 0)
+                close(fd);
+    }
+
+    /**
+     *@brief Read what the socket holds now
+     */
+    std::string Receive()
+    {
+        std::string received;
+        char        buffer[65536];
+        ssize_t     count;
+
+        while ((count = read(sockets[1], buffer, sizeof(buffer))) > 0)
+            received.append(buffer, count);
+
+        return received;
+    }
+};
+
+TEST_F(OutputQueueTest, KeepsWhatTheSocketRefused)
+{
+    server::OutputQueue output;
+    std::string         sent;
+
+    // Several pushes past the high-water mark, as a fast handler makes them
+    for (int i = 0; output.Size() < server::HIGH_WATER_MARK; i++)
+    {
+        std::string buffer(10000, static_cast<char>('a' + i % 26));
+        sent += buffer;
+        output.Push(std::move(buffer));
+    }
+
+    ASSERT_EQ(output.Flush(sockets[0]),
+              server::OutputQueue::FlushResult::BLOCKED);
+    EXPECT_GT(output.Size(), server::LOW_WATER_MARK);
+    EXPECT_EQ(output.Written() + output.Size(), sent.size());
+
+    // Each flush resumes where the last partial write stopped
+    std::string received;
+    while (!output.Empty())
+    {
+        received += Receive();
+        ASSERT_NE(output.Flush(sockets[0]),
+                  server::OutputQueue::FlushResult::ERROR);
+    }
+    received += Receive();
+
+    EXPECT_EQ(output.Size(), 0u);
+    EXPECT_EQ(output.Written(), sent.size());
+    EXPECT_EQ(received, sent);
+}
+
+TEST_F(OutputQueueTest, InterleavesBuffersAndFiles)
+{
+    char path[] = "/tmp/connection_test.XXXXXX";
+    int  file   = mkstemp(path);
+    ASSERT_GE(file, 0);
+    unlink(path);
+
+    std::string contents(100000, 'f');
+    ASSERT_EQ(write(file, contents.data(), contents.size()),
+              static_cast<ssize_t>(contents.size()));
+
+    server::OutputQueue output;
+    output.Push("head;");
+    output.PushFile(file, 10, 50000);
+    output.Push(";tail");
+    EXPECT_EQ(output.Size(), 50010u);
+
+    std::string received;
+    while (output.Flush(sockets[0]) != server::OutputQueue::FlushResult::DONE)
+        received += Receive();
+    received += Receive();
+
+    EXPECT_EQ(received, "head;" + contents.substr(10, 50000) + ";tail");
+}
+
+TEST_F(OutputQueueTest, ReportsABrokenConnection)
+{
+    // The server ignores it too, a write to a closed peer fails instead
+    std::signal(SIGPIPE, SIG_IGN);
+
+    close(sockets[1]);
+    sockets[1] = -1;
+
+    server::OutputQueue output;
+    output.Push("lost");
+
+    EXPECT_EQ(output.Flush(sockets[0]),
+              server::OutputQueue::FlushResult::ERROR);
+}
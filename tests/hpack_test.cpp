@@ -0,0 +1,111 @@
+#include "../src/http2/hpack.h"
+#include <gtest/gtest.h>
+
+/**
+ *@brief Turn the hex dumps of RFC 7541 Appendix C into bytes
+ */
+static std::string fromHex(std::string_view hex)
+{
+    std::string bytes;
+
+    for (std::size_t i = 0; i + 1 < hex.size(); i += 2)
+        bytes.push_back(static_cast<char>(
+            std::stoi(std::string(hex.substr(i, 2)), nullptr, 16)));
+
+    return bytes;
+}
+
+using Headers = std::vector<http2::Header>;
+
+// RFC 7541 C.3: requests without Huffman coding, sharing one dynamic table
+TEST(HpackDecoder, DecodesRequestsWithoutHuffman)
+{
+    http2::HpackDecoder decoder;
+
+    EXPECT_EQ(decoder.Decode(fromHex("828684410f7777772e6578616d706c652e636f6d")),
+              (Headers{{":method", "GET"},
+                       {":scheme", "http"},
+                       {":path", "/"},
+                       {":authority", "www.example.com"}}));
+
+    EXPECT_EQ(decoder.Decode(fromHex("828684be58086e6f2d6361636865")),
+              (Headers{{":method", "GET"},
+                       {":scheme", "http"},
+                       {":path", "/"},
+                       {":authority", "www.example.com"},
+                       {"cache-control", "no-cache"}}));
+
+    EXPECT_EQ(decoder.Decode(fromHex("828785bf400a637573746f6d2d6b65790c63757374"
+                                     "6f6d2d76616c7565")),
+              (Headers{{":method", "GET"},
+                       {":scheme", "https"},
+                       {":path", "/index.html"},
+                       {":authority", "www.example.com"},
+                       {"custom-key", "custom-value"}}));
+}
+
+// RFC 7541 C.4: the same requests with Huffman coding
+TEST(HpackDecoder, DecodesRequestsWithHuffman)
+{
+    http2::HpackDecoder decoder;
+
+    EXPECT_EQ(decoder.Decode(fromHex("828684418cf1e3c2e5f23a6ba0ab90f4ff")),
+              (Headers{{":method", "GET"},
+                       {":scheme", "http"},
+                       {":path", "/"},
+                       {":authority", "www.example.com"}}));
+
+    EXPECT_EQ(decoder.Decode(fromHex("828684be5886a8eb10649cbf")),
+              (Headers{{":method", "GET"},
+                       {":scheme", "http"},
+                       {":path", "/"},
+                       {":authority", "www.example.com"},
+                       {"cache-control", "no-cache"}}));
+
+    EXPECT_EQ(decoder.Decode(fromHex("828785bf408825a849e95ba97d7f8925a849e95bb8"
+                                     "e8b4bf")),
+              (Headers{{":method", "GET"},
+                       {":scheme", "https"},
+                       {":path", "/index.html"},
+                       {":authority", "www.example.com"},
+                       {"custom-key", "custom-value"}}));
+}
+
+TEST(HpackDecoder, RejectsMalformedBlocks)
+{
+    http2::HpackDecoder decoder;
+
+    // Index 0 is not a header
+    EXPECT_THROW(decoder.Decode(fromHex("80")), http2::HpackException);
+    // Past the end of the static table, with an empty dynamic table
+    EXPECT_THROW(decoder.Decode(fromHex("be")), http2::HpackException);
+    // A literal whose length runs past the block
+    EXPECT_THROW(decoder.Decode(fromHex("400a6375")), http2::HpackException);
+}
+
+TEST(HpackDecoder, BoundsTheHeaderListSize)
+{
+    http2::HpackDecoder decoder;
+
+    // `:method: GET' counts 7 + 3 + 32 bytes, a byte each on the wire
+    EXPECT_EQ(decoder.Decode(fromHex("8282"), 84).size(), 2u);
+    EXPECT_THROW(decoder.Decode(fromHex("828282"), 84),
+                 http2::HeaderListSizeException);
+}
+
+TEST(HpackEncoder, RoundTripsThroughTheDecoder)
+{
+    http2::HpackEncoder encoder;
+    http2::HpackDecoder decoder;
+    Headers             headers = {{":status", "200"},
+                                   {"content-type", "text/plain"},
+                                   {"x-custom", std::string(300, 'x')}};
+
+    // The second block refers to the dynamic table filled by the first
+    for (int i = 0; i < 2; i++)
+    {
+        std::string block;
+        encoder.Encode(headers, block);
+        EXPECT_EQ(decoder.Decode(block), headers);
+    }
+}
@@ -0,0 +1,102 @@
+#include "../src/server/path.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+TEST(Path, BelowRoute)
+{
+    EXPECT_STREQ(path::BelowRoute("/files/a/b.txt", "files"), "a/b.txt");
+    EXPECT_STREQ(path::BelowRoute("//files//a.txt", "files"), "a.txt");
+    EXPECT_STREQ(path::BelowRoute("/files", "files"), ".");
+    EXPECT_STREQ(path::BelowRoute("/files/", "files"), ".");
+    EXPECT_STREQ(path::BelowRoute("/index.html", ""), "index.html");
+    EXPECT_STREQ(path::BelowRoute("/", ""), ".");
+}
+
+/**
+ *@brief A scratch tree: `root/inside.txt', `root/sub/', `outside.txt' next to
+ * the root and symbolic links from the root to it
+ */
+class OpenBeneathTest : public ::testing::Test
+{
+protected:
+    std::string base;
+    int         root_fd = -1;
+
+    void SetUp() override
+    {
+        char scratch[] = "/tmp/path_test.XXXXXX";
+        ASSERT_NE(mkdtemp(scratch), nullptr);
+        base = scratch;
+
+        ASSERT_EQ(mkdir((base + "/root").c_str(), 0755), 0);
+        ASSERT_EQ(mkdir((base + "/root/sub").c_str(), 0755), 0);
+        close(creat((base + "/root/inside.txt").c_str(), 0644));
+        close(creat((base + "/outside.txt").c_str(), 0644));
+        ASSERT_EQ(symlink("../outside.txt", (base + "/root/link").c_str()), 0);
+        ASSERT_EQ(symlink("..", (base + "/root/up").c_str()), 0);
+
+        root_fd = open((base + "/root").c_str(), O_PATH | O_DIRECTORY);
+        ASSERT_GE(root_fd, 0);
+    }
+
+    void TearDown() override
+    {
+        close(root_fd);
+        std::string command = "rm -rf '" + base + "'";
+        ASSERT_EQ(system(command.c_str()), 0);
+    }
+
+    /**
+     *@brief Whether the path opens, closing it right away
+     */
+    bool Opens(const char * path, int flags = O_RDONLY)
+    {
+        int fd = path::OpenBeneath(root_fd, path, flags, 0644);
+        if (fd >= 0)
+            close(fd);
+        return fd >= 0;
+    }
+};
+
+TEST_F(OpenBeneathTest, OpensInsideTheRoot)
+{
+    EXPECT_TRUE(Opens("inside.txt"));
+    EXPECT_TRUE(Opens("sub/../inside.txt"));
+    EXPECT_TRUE(Opens("sub/new.txt", O_WRONLY | O_CREAT | O_TRUNC));
+}
+
+TEST_F(OpenBeneathTest, RefusesEscapes)
+{
+    EXPECT_FALSE(Opens("../outside.txt"));
+    EXPECT_FALSE(Opens("sub/../../outside.txt"));
+    EXPECT_FALSE(Opens((base + "/outside.txt").c_str()));
+    EXPECT_FALSE(Opens("link"));
+    EXPECT_FALSE(Opens("up/outside.txt"));
+    EXPECT_FALSE(Opens("up/new.txt", O_WRONLY | O_CREAT | O_TRUNC));
+}
+
+TEST_F(OpenBeneathTest, FallbackRefusesLinksAtAnyDepth)
+{
+    EXPECT_EQ(path::OpenByComponents(root_fd, "up/outside.txt", O_RDONLY),
+              -1);
+    EXPECT_EQ(path::OpenByComponents(root_fd, "up/new.txt",
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0644),
+              -1);
+    EXPECT_EQ(path::OpenByComponents(root_fd, "link", O_RDONLY), -1);
+    EXPECT_EQ(path::OpenByComponents(root_fd, "sub/../inside.txt", O_RDONLY),
+              -1);
+    EXPECT_EQ(path::OpenByComponents(root_fd, "/etc/passwd", O_RDONLY), -1);
+
+    int fd = path::OpenByComponents(root_fd, "sub/new.txt",
+                                    O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    EXPECT_GE(fd, 0);
+    close(fd);
+
+    fd = path::OpenByComponents(root_fd, "./sub//new.txt", O_RDONLY);
+    EXPECT_GE(fd, 0);
+    close(fd);
+}
@@ -0,0 +1,121 @@
+#include "../src/server/proxy.h"
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <string_view>
+
+/**
+ *@brief Feed a response one byte at a time, as a slow upstream sends it
+ *
+ * @return std::string what the client gets
+ */
+static std::string feedBytewise(proxy::ResponseReader & reader,
+                                std::string_view        response)
+{
+    std::string relay;
+
+    for (char c : response)
+        EXPECT_TRUE(reader.Feed(std::string_view(&c, 1), relay));
+
+    return relay;
+}
+
+TEST(ResponseReader, FollowsChunkedFraming)
+{
+    proxy::ResponseReader reader(false, false);
+    std::string           body = "5\r\nhello\r\n6; ext=1\r\n world\r\n0\r\n"
+                                 "Trailer: x\r\n\r\n";
+
+    std::string relay = feedBytewise(
+        reader, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" + body);
+
+    EXPECT_TRUE(reader.Done());
+    EXPECT_TRUE(reader.KeepAlive());
+    EXPECT_EQ(reader.GetStatusCode(), 200);
+    EXPECT_TRUE(relay.ends_with("\r\n\r\n" + body));
+
+    // Bytes past the end are not part of the response
+    std::string more;
+    EXPECT_TRUE(reader.Feed("HTTP/1.1 200 OK\r\n", more));
+    EXPECT_TRUE(more.empty());
+}
+
+TEST(ResponseReader, ReadsUntilCloseWithoutFraming)
+{
+    proxy::ResponseReader reader(false, false);
+    std::string           relay;
+
+    EXPECT_TRUE(reader.Feed("HTTP/1.1 200 OK\r\n\r\npart one, ", relay));
+    EXPECT_TRUE(reader.Feed("part two", relay));
+    EXPECT_FALSE(reader.Done());
+
+    EXPECT_TRUE(reader.FeedClose());
+    EXPECT_TRUE(reader.Done());
+    EXPECT_FALSE(reader.KeepAlive());
+    EXPECT_TRUE(reader.ClosesClient());
+    EXPECT_NE(relay.find("Connection: close\r\n"), std::string::npos);
+    EXPECT_TRUE(relay.ends_with("\r\n\r\npart one, part two"));
+}
+
+TEST(ResponseReader, CutShortBodyFails)
+{
+    proxy::ResponseReader reader(false, false);
+    std::string           relay;
+
+    EXPECT_TRUE(reader.Feed("HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n"
+                            "short",
+                            relay));
+    EXPECT_FALSE(reader.FeedClose());
+}
+
+TEST(ResponseReader, TransferEncodingOverridesContentLength)
+{
+    proxy::ResponseReader reader(false, false);
+    std::string           relay;
+
+    EXPECT_TRUE(reader.Feed("HTTP/1.1 200 OK\r\nContent-Length: 3\r\n"
+                            "Transfer-Encoding: chunked\r\n\r\n"
+                            "5\r\nhello\r\n0\r\n\r\n",
+                            relay));
+
+    EXPECT_TRUE(reader.Done());
+    EXPECT_EQ(relay.find("Content-Length"), std::string::npos);
+    EXPECT_TRUE(relay.ends_with("5\r\nhello\r\n0\r\n\r\n"));
+}
+
+TEST(ResponseReader, HeadResponseHasNoBody)
+{
+    proxy::ResponseReader reader(true, false);
+    std::string           relay;
+
+    EXPECT_TRUE(
+        reader.Feed("HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n", relay));
+    EXPECT_TRUE(reader.Done());
+}
+
+TEST(RewriteRequestHead, DropsHopByHopHeaders)
+{
+    std::uint32_t address;
+    inet_pton(AF_INET, "192.0.2.7", &address);
+
+    std::string head = proxy::RewriteRequestHead(
+        "GET /api HTTP/1.1\r\nHost: example.com\r\nConnection: close, "
+        "X-Private\r\nX-Private: 1\r\nKeep-Alive: 5\r\nUpgrade: h2c\r\n"
+        "Accept: */*\r\n\r\n",
+        address);
+
+    EXPECT_EQ(head, "GET /api HTTP/1.1\r\nHost: example.com\r\n"
+                    "Accept: */*\r\nX-Forwarded-For: 192.0.2.7\r\n\r\n");
+}
+
+TEST(RewriteRequestHead, ExtendsForwardedFor)
+{
+    std::uint32_t address;
+    inet_pton(AF_INET, "192.0.2.7", &address);
+
+    std::string head = proxy::RewriteRequestHead(
+        "GET / HTTP/1.1\r\nX-Forwarded-For: 198.51.100.1\r\n\r\n", address);
+
+    EXPECT_EQ(head, "GET / HTTP/1.1\r\n"
+                    "X-Forwarded-For: 198.51.100.1, 192.0.2.7\r\n\r\n");
+}
@@ -0,0 +1,46 @@
+#include "../src/http/scan.h"
+#include <gtest/gtest.h>
+#include <random>
+
+// Every kernel the CPU runs must agree with the scalar one
+TEST(Scan, KernelsAgreeWithScalar)
+{
+    std::mt19937           random(42);
+    scan::HeaderNameKernel scalar =
+        scan::HeaderNameKernelOf(scan::Kernel::SCALAR);
+
+    for (scan::Kernel kind : {scan::Kernel::SSSE3, scan::Kernel::AVX2})
+    {
+        scan::HeaderNameKernel kernel = scan::HeaderNameKernelOf(kind);
+
+        if (!kernel)
+            continue;
+
+        for (std::size_t size = 1; size < 200; size++)
+        {
+            std::string data(size, '\0');
+            for (char & c : data) c = static_cast<char>(random() % 128);
+
+            EXPECT_EQ(kernel(data.data(), size), scalar(data.data(), size));
+
+            // A valid name of the same length, broken at its last byte
+            std::string name(size, 'a');
+            EXPECT_TRUE(kernel(name.data(), size));
+            name.back() = ' ';
+            EXPECT_FALSE(kernel(name.data(), size));
+        }
+    }
+}
+
+TEST(Scan, FindsTheFirstDelimiter)
+{
+    std::string data(100, 'a');
+    data[70] = ':';
+    data[90] = ':';
+
+    EXPECT_EQ(scan::FindByte(data, ':'), 70u);
+    EXPECT_EQ(scan::FindByte(data, '\n'), std::string_view::npos);
+    EXPECT_FALSE(scan::IsValidHeaderName(""));
+    EXPECT_TRUE(scan::IsValidHeaderName("Content-Length"));
+    EXPECT_FALSE(scan::IsValidHeaderName("Content Length"));
+}
@@ -0,0 +1,99 @@
+#include "../src/server/task.h"
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <optional>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/**
+ *@brief Write two pieces to a file, then read back a range across them
+ */
+static task::Task<std::optional<std::string>> writeThenRead(task::File & file)
+{
+    for (std::string piece : {"hello, ", "world"})
+    {
+        bool written = co_await file.Write(std::move(piece));
+        if (!written)
+            co_return std::nullopt;
+    }
+
+    co_return co_await file.Read(3, 100);
+}
+
+/**
+ *@brief An unlinked scratch file
+ */
+static int scratchFile()
+{
+    char path[] = "/tmp/task_test.XXXXXX";
+    int  fd     = mkstemp(path);
+
+    unlink(path);
+    return fd;
+}
+
+TEST(File, RunsWithoutOffload)
+{
+    task::File file(scratchFile());
+    ASSERT_TRUE(file.IsOpen());
+
+    // Nothing suspends, the task finishes as it starts
+    auto task = writeThenRead(file);
+    task.Start();
+
+    ASSERT_TRUE(task.Done());
+    EXPECT_EQ(task.Result(), "lo, world");
+}
+
+TEST(File, SuspendsOnOffload)
+{
+    // Stands in for the worker pool and the event loop
+    std::vector<std::pair<std::function<void()>, std::coroutine_handle<>>>
+        queued;
+
+    task::File file(scratchFile(),
+                    [&queued](std::function<void()>   work,
+                              std::coroutine_handle<> awaiting) {
+                        queued.emplace_back(std::move(work), awaiting);
+                    });
+
+    auto task = writeThenRead(file);
+    task.Start();
+
+    // One operation at a time, each resuming the task once it ran
+    for (int operations = 0; !task.Done(); operations++)
+    {
+        ASSERT_LT(operations, 3);
+        ASSERT_EQ(queued.size(), 1u);
+
+        auto [work, awaiting] = std::move(queued.back());
+        queued.pop_back();
+
+        work();
+        awaiting.resume();
+    }
+
+    EXPECT_EQ(task.Result(), "lo, world");
+}
+
+TEST(File, OperationOutlivesItsFrame)
+{
+    std::function<void()> orphan;
+
+    {
+        task::File file(scratchFile(),
+                        [&orphan](std::function<void()>   work,
+                                  std::coroutine_handle<>) {
+                            orphan = std::move(work);
+                        });
+
+        auto task = writeThenRead(file);
+        task.Start();
+        ASSERT_FALSE(task.Done());
+    }
+
+    // The file and the data are still there for the worker
+    orphan();
+}
@@ -0,0 +1,164 @@
+#include "../src/server/workers.h"
+#include <atomic>
+#include <future>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ *@brief Run completions as the event loop does until `done' holds
+ *
+ * @return false it did not hold within a few seconds
+ */
+template <typename Predicate>
+static bool runUntil(workers::ThreadPool & pool, Predicate done)
+{
+    for (int waited = 0; !done(); waited++)
+    {
+        if (waited == 500)
+            return false;
+
+        pollfd completion = {pool.GetCompletionFd(), POLLIN, 0};
+        if (poll(&completion, 1, 10) == 1)
+            pool.RunCompletions();
+    }
+
+    return true;
+}
+
+/**
+ *@brief A pool of `threads' workers, started
+ */
+static void startPool(workers::ThreadPool & pool, const std::string & threads)
+{
+    ASSERT_TRUE(pool.Configure("--worker-threads", threads));
+    ASSERT_TRUE(pool.Start());
+    ASSERT_TRUE(pool.Enabled());
+}
+
+TEST(ThreadPool, ParsesTheThreadCount)
+{
+    workers::ThreadPool pool;
+
+    EXPECT_TRUE(pool.Configure("--worker-threads", "0"));
+    EXPECT_TRUE(pool.Configure("--worker-threads", "256"));
+    EXPECT_FALSE(pool.Configure("--worker-threads", "257"));
+    EXPECT_FALSE(pool.Configure("--worker-threads", "4x"));
+    EXPECT_FALSE(pool.Configure("--worker-threads", "-1"));
+    EXPECT_FALSE(pool.Configure("--worker-threads", ""));
+    EXPECT_FALSE(pool.Configure("--threads", "4"));
+}
+
+TEST(ThreadPool, RunsCompletionsOnTheCallingThread)
+{
+    workers::ThreadPool pool;
+    startPool(pool, "4");
+
+    std::atomic<int> worked{0};
+    int              completed = 0;
+    std::thread::id  loop      = std::this_thread::get_id();
+    bool             elsewhere = false;
+
+    for (int i = 0; i < 100; i++)
+        pool.Submit(
+            i % 2 ? workers::Priority::BULK : workers::Priority::LATENCY,
+            [&worked] { worked++; },
+            [&] {
+                completed++;
+                elsewhere |= std::this_thread::get_id() != loop;
+            });
+
+    ASSERT_TRUE(runUntil(pool, [&] { return completed == 100; }));
+    EXPECT_EQ(worked, 100);
+    EXPECT_FALSE(elsewhere);
+}
+
+TEST(ThreadPool, RunsLatencyJobsFirst)
+{
+    // One worker, held busy while the queue fills
+    workers::ThreadPool pool;
+    startPool(pool, "1");
+
+    std::promise<void> release;
+    std::vector<int>   order;
+    std::mutex         order_mutex;
+    int                completed = 0;
+
+    auto record = [&](int job) {
+        return [&, job] {
+            std::lock_guard<std::mutex> lock(order_mutex);
+            order.push_back(job);
+        };
+    };
+
+    pool.Submit(workers::Priority::LATENCY,
+                [gate = release.get_future().share()] { gate.wait(); },
+                [&] { completed++; });
+    pool.Submit(workers::Priority::BULK, record(1), [&] { completed++; });
+    pool.Submit(workers::Priority::LATENCY, record(2), [&] { completed++; });
+    pool.Submit(workers::Priority::BULK, record(3), [&] { completed++; });
+    pool.Submit(workers::Priority::LATENCY, record(4), [&] { completed++; });
+
+    release.set_value();
+
+    ASSERT_TRUE(runUntil(pool, [&] { return completed == 5; }));
+    EXPECT_EQ(order, (std::vector<int>{2, 4, 1, 3}));
+}
+
+TEST(ThreadPool, KeepsAWorkerFromBulkJobs)
+{
+    workers::ThreadPool pool;
+    startPool(pool, "2");
+
+    std::promise<void> release;
+    auto               gate         = release.get_future().share();
+    std::atomic<int>   bulk_running = 0;
+    std::atomic<bool>  latency_done = false;
+    int                completed    = 0;
+
+    // Both bulk jobs block, only one may hold a worker
+    for (int i = 0; i < 2; i++)
+        pool.Submit(
+            workers::Priority::BULK,
+            [&bulk_running, gate] {
+                bulk_running++;
+                gate.wait();
+            },
+            [&] { completed++; });
+
+    pool.Submit(workers::Priority::LATENCY, [&] { latency_done = true; },
+                [&] { completed++; });
+
+    ASSERT_TRUE(runUntil(pool, [&] { return latency_done.load(); }));
+    EXPECT_EQ(bulk_running, 1);
+
+    release.set_value();
+    ASSERT_TRUE(runUntil(pool, [&] { return completed == 3; }));
+}
+
+TEST(ThreadPool, StealsFromABusyWorker)
+{
+    workers::ThreadPool pool;
+    startPool(pool, "2");
+
+    std::promise<void> release;
+    std::atomic<int>   finished = 0;
+    int                completed = 0;
+
+    // Jobs are dealt to both deques in turn; whichever worker runs the
+    // blocking one, the other takes the jobs queued behind it
+    pool.Submit(workers::Priority::LATENCY,
+                [gate = release.get_future().share()] { gate.wait(); },
+                [&] { completed++; });
+    for (int i = 0; i < 20; i++)
+        pool.Submit(workers::Priority::LATENCY, [&finished] { finished++; },
+                    [&] { completed++; });
+
+    EXPECT_TRUE(runUntil(pool, [&] { return completed == 20; }));
+    EXPECT_EQ(finished, 20);
+
+    release.set_value();
+    ASSERT_TRUE(runUntil(pool, [&] { return completed == 21; }));
+}